@@ -16,6 +16,7 @@
 // This file is modified from <https://github.com/JakobEngel/dso>
 
 #include "CoarseTracker.h"
+#include "DistanceTransform.h"
 #include "FullSystem/FullSystem.h"
 #include "FullSystem/HessianBlocks.h"
 #include "FullSystem/Residuals.h"
@@ -48,22 +49,20 @@ CoarseTracker::CoarseTracker(int ww, int hh) : lastRef_aff_g2l(0, 0) {
     pc_v_[lvl] = allocAligned<4, float>(wl * hl, ptrToDelete);
     pc_idepth_[lvl] = allocAligned<4, float>(wl * hl, ptrToDelete);
     pc_color_[lvl] = allocAligned<4, float>(wl * hl, ptrToDelete);
+    pc_J_[lvl] = setting_coarseTrackingMode == 1
+                     ? allocAligned<4, float>(8 * wl * hl, ptrToDelete)
+                     : 0;
   }
 
   w_[0] = h_[0] = 0;
-  // pose warped buffers
-  poseBufWarped_idepth = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_u = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_v = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_dx = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_dy = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_residual = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_weight = allocAligned<4, float>(ww * hh, ptrToDelete);
-  poseBufWarped_refColor = allocAligned<4, float>(ww * hh, ptrToDelete);
 
   newFrame = 0;
   lastRef = 0;
   refFrameID = -1;
+  snapshotRefFrameID = -1;
+  lastNumIterations = 0;
+  lastNumLevels = 0;
+  medianIdepth = 0;
 }
 
 CoarseTracker::~CoarseTracker() {
@@ -98,51 +97,18 @@ void CoarseTracker::makeK(CalibHessian *HCalib) {
   }
 }
 
-void CoarseTracker::makeCoarseDepthL0(
-    std::vector<FrameHessian *> frameHessians) {
+void CoarseTracker::makeCoarseDepthL0() {
   // make coarse tracking templates for latstRef.
   memset(idepth_[0], 0, sizeof(float) * w_[0] * h_[0]);
   memset(weight_sums_[0], 0, sizeof(float) * w_[0] * h_[0]);
 
-  for (FrameHessian *fh : frameHessians) {
-    for (PointHessian *ph : fh->pointHessians) {
-      if (ph->lastResiduals[0].first != 0 &&
-          ph->lastResiduals[0].second == ResState::IN) {
-        PointFrameResidual *r = ph->lastResiduals[0].first;
-        assert(r->efResidual->isActive() && r->target == lastRef);
-        int u = r->centerProjectedTo[0] + 0.5f;
-        int v = r->centerProjectedTo[1] + 0.5f;
-        float new_idepth = r->centerProjectedTo[2];
-        float weight = sqrtf(1e-3 / (ph->efPoint->HdiF + 1e-12));
-
-        idepth_[0][u + w_[0] * v] += new_idepth * weight;
-        weight_sums_[0][u + w_[0] * v] += weight;
-      }
-    }
+  for (const RefPoint &p : refPointSnapshot) {
+    idepth_[0][p.idx] += p.idepth * p.weight;
+    weight_sums_[0][p.idx] += p.weight;
   }
 
-  for (int lvl = 1; lvl < pyrLevelsUsed; lvl++) {
-    int lvlm1 = lvl - 1;
-    int wl = w_[lvl], hl = h_[lvl], wlm1 = w_[lvlm1];
-
-    float *idepth_l = idepth_[lvl];
-    float *weight_sums_l = weight_sums_[lvl];
-
-    float *idepth_lm = idepth_[lvlm1];
-    float *weight_sums_lm = weight_sums_[lvlm1];
-
-    for (int y = 0; y < hl; y++)
-      for (int x = 0; x < wl; x++) {
-        int bidx = 2 * x + 2 * y * wlm1;
-        idepth_l[x + y * wl] = idepth_lm[bidx] + idepth_lm[bidx + 1] +
-                               idepth_lm[bidx + wlm1] +
-                               idepth_lm[bidx + wlm1 + 1];
-
-        weight_sums_l[x + y * wl] =
-            weight_sums_lm[bidx] + weight_sums_lm[bidx + 1] +
-            weight_sums_lm[bidx + wlm1] + weight_sums_lm[bidx + wlm1 + 1];
-      }
-  }
+  for (int lvl = 1; lvl < pyrLevelsUsed; lvl++)
+    downsampleCoarseDepth(lvl);
 
   // dilate idepth_ by 1.
   for (int lvl = 0; lvl < 2; lvl++) {
@@ -269,19 +235,185 @@ void CoarseTracker::makeCoarseDepthL0(
       }
 
     pc_n_[lvl] = lpc_n;
+
+    if (setting_spatialPointOrder)
+      sortCoarsePointsMorton(lvl);
+  }
+}
+
+void CoarseTracker::sortCoarsePointsMorton(int lvl) {
+  int nl = pc_n_[lvl];
+  float *pc[4] = {pc_u_[lvl], pc_v_[lvl], pc_idepth_[lvl], pc_color_[lvl]};
+
+  mortonKeys.resize(nl);
+  for (int i = 0; i < nl; i++)
+    mortonKeys[i] =
+        ((uint64_t)mortonCode((uint32_t)pc[0][i], (uint32_t)pc[1][i]) << 32) |
+        i;
+  std::sort(mortonKeys.begin(), mortonKeys.end());
+
+  // weight_sums_bak_ is free once the idepths are normalized.
+  float *tmp = weight_sums_bak_[lvl];
+  for (int k = 0; k < 4; k++) {
+    for (int i = 0; i < nl; i++)
+      tmp[i] = pc[k][(uint32_t)mortonKeys[i]];
+    memcpy(pc[k], tmp, sizeof(float) * nl);
+  }
+}
+
+void CoarseTracker::downsampleCoarseDepth(int lvl) {
+  // sum of 2x2 blocks, four output pixels per step: rows 2y and 2y+1 are
+  // added, then even and odd columns are separated and added.
+  int lvlm1 = lvl - 1;
+  int wl = w_[lvl], hl = h_[lvl], wlm1 = w_[lvlm1];
+
+  float *idepth_l = idepth_[lvl];
+  float *weight_sums_l = weight_sums_[lvl];
+
+  float *idepth_lm = idepth_[lvlm1];
+  float *weight_sums_lm = weight_sums_[lvlm1];
+
+  for (int y = 0; y < hl; y++) {
+    const float *id0 = idepth_lm + 2 * y * wlm1;
+    const float *id1 = id0 + wlm1;
+    const float *ws0 = weight_sums_lm + 2 * y * wlm1;
+    const float *ws1 = ws0 + wlm1;
+    float *idOut = idepth_l + y * wl;
+    float *wsOut = weight_sums_l + y * wl;
+
+    int x = 0;
+    for (; x + 4 <= wl; x += 4) {
+      __m128 idLo = _mm_add_ps(_mm_loadu_ps(id0 + 2 * x),
+                               _mm_loadu_ps(id1 + 2 * x));
+      __m128 idHi = _mm_add_ps(_mm_loadu_ps(id0 + 2 * x + 4),
+                               _mm_loadu_ps(id1 + 2 * x + 4));
+      _mm_storeu_ps(
+          idOut + x,
+          _mm_add_ps(_mm_shuffle_ps(idLo, idHi, _MM_SHUFFLE(2, 0, 2, 0)),
+                     _mm_shuffle_ps(idLo, idHi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+      __m128 wsLo = _mm_add_ps(_mm_loadu_ps(ws0 + 2 * x),
+                               _mm_loadu_ps(ws1 + 2 * x));
+      __m128 wsHi = _mm_add_ps(_mm_loadu_ps(ws0 + 2 * x + 4),
+                               _mm_loadu_ps(ws1 + 2 * x + 4));
+      _mm_storeu_ps(
+          wsOut + x,
+          _mm_add_ps(_mm_shuffle_ps(wsLo, wsHi, _MM_SHUFFLE(2, 0, 2, 0)),
+                     _mm_shuffle_ps(wsLo, wsHi, _MM_SHUFFLE(3, 1, 3, 1))));
+    }
+    for (; x < wl; x++) {
+      idOut[x] = id0[2 * x] + id0[2 * x + 1] + id1[2 * x] + id1[2 * x + 1];
+      wsOut[x] = ws0[2 * x] + ws0[2 * x + 1] + ws1[2 * x] + ws1[2 * x + 1];
+    }
   }
 }
 
-void CoarseTracker::setCoarseTrackingRef(
+void CoarseTracker::snapshotCoarseTrackingRef(
     std::vector<FrameHessian *> frameHessians) {
   assert(frameHessians.size() > 0);
   lastRef = frameHessians.back();
-  makeCoarseDepthL0(frameHessians);
-
-  refFrameID = lastRef->shell->id;
   lastRef_aff_g2l = lastRef->aff_g2l();
+  snapshotRefFrameID = lastRef->shell->id;
+
+  refPointSnapshot.clear();
+  for (FrameHessian *fh : frameHessians) {
+    for (PointHessian *ph : fh->pointHessians) {
+      if (ph->lastResiduals[0].first != 0 &&
+          ph->lastResiduals[0].second == ResState::IN) {
+        PointFrameResidual *r = ph->lastResiduals[0].first;
+        assert(r->efResidual->isActive() && r->target == lastRef);
+        int u = r->centerProjectedTo[0] + 0.5f;
+        int v = r->centerProjectedTo[1] + 0.5f;
+
+        RefPoint p;
+        p.idx = u + w_[0] * v;
+        p.idepth = r->centerProjectedTo[2];
+        p.weight = sqrtf(1e-3 / (ph->efPoint->HdiF + 1e-12));
+        refPointSnapshot.push_back(p);
+      }
+    }
+  }
+}
+
+void CoarseTracker::buildCoarseTrackingRef() {
+  makeCoarseDepthL0();
+
+  if (setting_coarseTrackingMode == 1)
+    makeCoarseJacobiansIC();
+
+  std::vector<float> idepths(pc_idepth_[0], pc_idepth_[0] + pc_n_[0]);
+  medianIdepth = 0;
+  if (!idepths.empty()) {
+    std::nth_element(idepths.begin(), idepths.begin() + idepths.size() / 2,
+                     idepths.end());
+    medianIdepth = idepths[idepths.size() / 2];
+  }
 
   firstCoarseRMSE = -1;
+  refFrameID = snapshotRefFrameID;
+}
+
+void CoarseTracker::makeCoarseJacobiansIC() {
+  // the reference points stay fixed until the next keyframe, so the
+  // Jacobians w.r.t. a reference-side perturbation exp(d) * X_ref are
+  // computed once here. per point: the 6 pose entries (without the -a factor),
+  // b0 - refColor and -1. H_ic_ is the mean of their unweighted, scaled outer
+  // products over all points of the level, b in calcResAndGS the mean over
+  // the terms of the warp. a level without points leaves H_ic_ zero.
+  Vec8 scale;
+  scale.segment<3>(0).setConstant(SCALE_XI_ROT);
+  scale.segment<3>(3).setConstant(SCALE_XI_TRANS);
+  scale[6] = SCALE_A;
+  scale[7] = SCALE_B;
+
+  float b0 = lastRef_aff_g2l.b;
+  for (int lvl = 0; lvl < pyrLevelsUsed; lvl++) {
+    Eigen::Vector3f *dIRefl = lastRef->dIp[lvl];
+    float fxl = fx_[lvl];
+    float fyl = fy_[lvl];
+    int wl = w_[lvl];
+
+    int nl = pc_n_[lvl];
+    float *lpc_u = pc_u_[lvl];
+    float *lpc_v = pc_v_[lvl];
+    float *lpc_idepth = pc_idepth_[lvl];
+    float *lpc_color = pc_color_[lvl];
+    float *lpc_J = pc_J_[lvl];
+
+    poseAcc.initialize();
+    for (int i = 0; i < nl; i++) {
+      float x = lpc_u[i];
+      float y = lpc_v[i];
+      float id = lpc_idepth[i];
+      float u = Ki_[lvl](0, 0) * x + Ki_[lvl](0, 2);
+      float v = Ki_[lvl](1, 1) * y + Ki_[lvl](1, 2);
+      int idx = (int)x + (int)y * wl;
+      float dx = fxl * dIRefl[idx][1];
+      float dy = fyl * dIRefl[idx][2];
+
+      float *J = lpc_J + 8 * i;
+      J[0] = id * dx;
+      J[1] = id * dy;
+      J[2] = -id * (u * dx + v * dy);
+      J[3] = -(u * v * dx + dy * (1 + v * v));
+      J[4] = u * v * dy + dx * (1 + u * u);
+      J[5] = u * dy - v * dx;
+      J[6] = b0 - lpc_color[i];
+      J[7] = -1;
+
+      poseAcc.updateSingleWeighted(J[0], J[1], J[2], J[3], J[4], J[5], J[6],
+                                   J[7], 0, 1);
+    }
+    poseAcc.finish();
+
+    if (nl == 0) {
+      H_ic_[lvl].setZero();
+      continue;
+    }
+    H_ic_[lvl] = scale.asDiagonal() *
+                 poseAcc.H.topLeftCorner<8, 8>().cast<double>() *
+                 scale.asDiagonal() * (1.0f / nl);
+  }
 }
 
 void CoarseTracker::scaleCoarseDepthL0(float scale) {
@@ -291,6 +423,10 @@ void CoarseTracker::scaleCoarseDepthL0(float scale) {
       lpc_idepth[p] /= scale;
     }
   }
+  medianIdepth /= scale;
+
+  if (setting_coarseTrackingMode == 1)
+    makeCoarseJacobiansIC();
 }
 
 void CoarseTracker::debugPlotIDepthMap(
@@ -417,6 +553,8 @@ bool CoarseTracker::trackNewestCoarse(FrameHessian *newFrameHessian,
   lastFlowIndicators.setConstant(1000);
 
   newFrame = newFrameHessian;
+  lastNumIterations = 0;
+  lastNumLevels = 0;
   int maxIterations[] = {10, 20, 50, 50, 50};
   float lambdaExtrapolationLimit = 0.001;
 
@@ -429,20 +567,19 @@ bool CoarseTracker::trackNewestCoarse(FrameHessian *newFrameHessian,
     Mat88 H;
     Vec8 b;
     float levelCutoffRepeat = 1;
-    Vec6 resOld = calcRes(lvl, refToNew_current, aff_g2l_current,
-                          setting_coarseCutoffTH * levelCutoffRepeat);
+    lastNumLevels++;
+    Vec6 resOld = calcResAndGS(lvl, H, b, refToNew_current, aff_g2l_current,
+                               setting_coarseCutoffTH * levelCutoffRepeat);
     while (resOld[5] > 0.6 && levelCutoffRepeat < 50) {
       levelCutoffRepeat *= 2;
-      resOld = calcRes(lvl, refToNew_current, aff_g2l_current,
-                       setting_coarseCutoffTH * levelCutoffRepeat);
+      resOld = calcResAndGS(lvl, H, b, refToNew_current, aff_g2l_current,
+                            setting_coarseCutoffTH * levelCutoffRepeat);
 
       if (!setting_debugout_runquiet)
         printf("INCREASING cutoff to %f (ratio is %f)!\n",
                setting_coarseCutoffTH * levelCutoffRepeat, resOld[5]);
     }
 
-    calcGSSSE(lvl, H, b, refToNew_current, aff_g2l_current);
-
     float lambda = 0.01;
 
     if (DEBUG_PRINT) {
@@ -504,16 +641,23 @@ bool CoarseTracker::trackNewestCoarse(FrameHessian *newFrameHessian,
       if (!std::isfinite(incScaled.sum()))
         incScaled.setZero();
 
+      // forward-additive updates the new frame side, inverse-compositional
+      // inverts the increment found on the reference side.
       SE3 refToNew_new =
-          SE3::exp((Vec6)(incScaled.head<6>())) * refToNew_current;
+          setting_coarseTrackingMode == 1
+              ? refToNew_current * SE3::exp(-(Vec6)(incScaled.head<6>()))
+              : SE3::exp((Vec6)(incScaled.head<6>())) * refToNew_current;
       AffLight aff_g2l_new = aff_g2l_current;
       aff_g2l_new.a += incScaled[6];
       aff_g2l_new.b += incScaled[7];
 
-      Vec6 resNew = calcRes(lvl, refToNew_new, aff_g2l_new,
-                            setting_coarseCutoffTH * levelCutoffRepeat);
+      Mat88 H_new;
+      Vec8 b_new;
+      Vec6 resNew = calcResAndGS(lvl, H_new, b_new, refToNew_new, aff_g2l_new,
+                                 setting_coarseCutoffTH * levelCutoffRepeat);
 
       bool accept = (resNew[0] / resNew[1]) < (resOld[0] / resOld[1]);
+      lastNumIterations++;
 
       if (DEBUG_PRINT) {
         Vec2f relAff = AffLight::fromToVecExposure(lastRef->ab_exposure,
@@ -531,7 +675,8 @@ bool CoarseTracker::trackNewestCoarse(FrameHessian *newFrameHessian,
                   << relAff.transpose() << ")\n";
       }
       if (accept) {
-        calcGSSSE(lvl, H, b, refToNew_new, aff_g2l_new);
+        H = H_new;
+        b = b_new;
         resOld = resNew;
         aff_g2l_current = aff_g2l_new;
         refToNew_current = refToNew_new;
@@ -588,72 +733,82 @@ bool CoarseTracker::trackNewestCoarse(FrameHessian *newFrameHessian,
     aff_g2l_out.b = 0;
 
   if (DEBUG_PLOT) {
-    calcRes(0, lastToNew_out, aff_g2l_out, setting_coarseCutoffTH, true);
+    Mat88 H;
+    Vec8 b;
+    calcResAndGS(0, H, b, lastToNew_out, aff_g2l_out, setting_coarseCutoffTH,
+                 true);
   }
 
   return true;
 }
 
-void CoarseTracker::calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out,
-                              const SE3 &refToNew, AffLight aff_g2l) {
-  poseAcc.initialize();
-
-  __m128 fxl = _mm_set1_ps(fx_[lvl]);
-  __m128 fyl = _mm_set1_ps(fy_[lvl]);
-  __m128 b0 = _mm_set1_ps(lastRef_aff_g2l.b);
-  __m128 a = _mm_set1_ps((float)(AffLight::fromToVecExposure(
-      lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l,
-      aff_g2l)[0]));
-
+void CoarseTracker::accumulateGSLanes(const float *lanes, __m128 fxl,
+                                      __m128 fyl, __m128 a, __m128 b0) {
   __m128 one = _mm_set1_ps(1);
   __m128 minusOne = _mm_set1_ps(-1);
   __m128 zero = _mm_set1_ps(0);
 
-  int n = poseBufWarped_n;
-  assert(n % 4 == 0);
-  for (int i = 0; i < n; i += 4) {
-    __m128 dx = _mm_mul_ps(_mm_load_ps(poseBufWarped_dx + i), fxl);
-    __m128 dy = _mm_mul_ps(_mm_load_ps(poseBufWarped_dy + i), fyl);
-    __m128 u = _mm_load_ps(poseBufWarped_u + i);
-    __m128 v = _mm_load_ps(poseBufWarped_v + i);
-    __m128 id = _mm_load_ps(poseBufWarped_idepth + i);
-
-    poseAcc.updateSSE_eighted(
-        _mm_mul_ps(id, dx), _mm_mul_ps(id, dy),
-        _mm_sub_ps(zero, _mm_mul_ps(id, _mm_add_ps(_mm_mul_ps(u, dx),
-                                                   _mm_mul_ps(v, dy)))),
-        _mm_sub_ps(
-            zero,
-            _mm_add_ps(_mm_mul_ps(_mm_mul_ps(u, v), dx),
-                       _mm_mul_ps(dy, _mm_add_ps(one, _mm_mul_ps(v, v))))),
-        _mm_add_ps(_mm_mul_ps(_mm_mul_ps(u, v), dy),
-                   _mm_mul_ps(dx, _mm_add_ps(one, _mm_mul_ps(u, u)))),
-        _mm_sub_ps(_mm_mul_ps(u, dy), _mm_mul_ps(v, dx)),
-        _mm_mul_ps(a, _mm_sub_ps(b0, _mm_load_ps(poseBufWarped_refColor + i))),
-        minusOne, _mm_load_ps(poseBufWarped_residual + i),
-        _mm_load_ps(poseBufWarped_weight + i));
-  }
-
-  poseAcc.finish();
-  H_out = poseAcc.H.topLeftCorner<8, 8>().cast<double>() * (1.0f / n);
-  b_out = poseAcc.H.topRightCorner<8, 1>().cast<double>() * (1.0f / n);
+  __m128 id = _mm_load_ps(lanes);
+  __m128 u = _mm_load_ps(lanes + 4);
+  __m128 v = _mm_load_ps(lanes + 8);
+  __m128 dx = _mm_mul_ps(_mm_load_ps(lanes + 12), fxl);
+  __m128 dy = _mm_mul_ps(_mm_load_ps(lanes + 16), fyl);
+
+  poseAcc.updateSSE_eighted(
+      _mm_mul_ps(id, dx), _mm_mul_ps(id, dy),
+      _mm_sub_ps(zero, _mm_mul_ps(id, _mm_add_ps(_mm_mul_ps(u, dx),
+                                                 _mm_mul_ps(v, dy)))),
+      _mm_sub_ps(zero,
+                 _mm_add_ps(_mm_mul_ps(_mm_mul_ps(u, v), dx),
+                            _mm_mul_ps(dy, _mm_add_ps(one, _mm_mul_ps(v, v))))),
+      _mm_add_ps(_mm_mul_ps(_mm_mul_ps(u, v), dy),
+                 _mm_mul_ps(dx, _mm_add_ps(one, _mm_mul_ps(u, u)))),
+      _mm_sub_ps(_mm_mul_ps(u, dy), _mm_mul_ps(v, dx)),
+      _mm_mul_ps(a, _mm_sub_ps(b0, _mm_load_ps(lanes + 28))), minusOne,
+      _mm_load_ps(lanes + 20), _mm_load_ps(lanes + 24));
+}
 
-  H_out.block<8, 3>(0, 0) *= SCALE_XI_ROT;
-  H_out.block<8, 3>(0, 3) *= SCALE_XI_TRANS;
-  H_out.block<8, 1>(0, 6) *= SCALE_A;
-  H_out.block<8, 1>(0, 7) *= SCALE_B;
-  H_out.block<3, 8>(0, 0) *= SCALE_XI_ROT;
-  H_out.block<3, 8>(3, 0) *= SCALE_XI_TRANS;
-  H_out.block<1, 8>(6, 0) *= SCALE_A;
-  H_out.block<1, 8>(7, 0) *= SCALE_B;
-  b_out.segment<3>(0) *= SCALE_XI_ROT;
-  b_out.segment<3>(3) *= SCALE_XI_TRANS;
-  b_out.segment<1>(6) *= SCALE_A;
-  b_out.segment<1>(7) *= SCALE_B;
+// accumulateGSLanes for 8 lanes (laid out 8 per field) with AVX2/FMA.
+static DSO_TARGET_AVX2 void accumulateGSLanesAVX(Accumulator9 &acc,
+                                                 const float *lanes, float fxl,
+                                                 float fyl, float a, float b0) {
+#if DSO_AVX_DISPATCH
+  __m256 one = _mm256_set1_ps(1);
+  __m256 id = _mm256_load_ps(lanes);
+  __m256 u = _mm256_load_ps(lanes + 8);
+  __m256 v = _mm256_load_ps(lanes + 16);
+  __m256 dx = _mm256_mul_ps(_mm256_load_ps(lanes + 24), _mm256_set1_ps(fxl));
+  __m256 dy = _mm256_mul_ps(_mm256_load_ps(lanes + 32), _mm256_set1_ps(fyl));
+  __m256 uv = _mm256_mul_ps(u, v);
+
+  EIGEN_ALIGN_TO_BOUNDARY(32) float J[9 * 8];
+  _mm256_store_ps(J, _mm256_mul_ps(id, dx));
+  _mm256_store_ps(J + 8, _mm256_mul_ps(id, dy));
+  __m256 zero = _mm256_setzero_ps();
+  _mm256_store_ps(
+      J + 16,
+      _mm256_sub_ps(zero, _mm256_mul_ps(id, _mm256_fmadd_ps(
+                                                u, dx, _mm256_mul_ps(v, dy)))));
+  __m256 dy_vv = _mm256_mul_ps(dy, _mm256_fmadd_ps(v, v, one));
+  _mm256_store_ps(J + 24, _mm256_sub_ps(zero, _mm256_fmadd_ps(uv, dx, dy_vv)));
+  __m256 dx_uu = _mm256_mul_ps(dx, _mm256_fmadd_ps(u, u, one));
+  _mm256_store_ps(J + 32, _mm256_fmadd_ps(uv, dy, dx_uu));
+  _mm256_store_ps(J + 40, _mm256_sub_ps(_mm256_mul_ps(u, dy),
+                                        _mm256_mul_ps(v, dx)));
+  _mm256_store_ps(J + 48,
+                  _mm256_mul_ps(_mm256_set1_ps(a),
+                                _mm256_sub_ps(_mm256_set1_ps(b0),
+                                              _mm256_load_ps(lanes + 56))));
+  _mm256_store_ps(J + 56, _mm256_set1_ps(-1));
+  _mm256_store_ps(J + 64, _mm256_load_ps(lanes + 40));
+
+  acc.updateAVX_eighted(J, lanes + 48);
+#endif
 }
 
-Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l,
-                            float cutoffTH, bool plot_img) {
+Vec6 CoarseTracker::calcResAndGS(int lvl, Mat88 &H_out, Vec8 &b_out,
+                                 const SE3 &refToNew, AffLight aff_g2l,
+                                 float cutoffTH, bool plot_img) {
   float E = 0;
   int numTermsInE = 0;
   int numTermsInWarped = 0;
@@ -688,11 +843,30 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l,
     resImage->setConst(Vec3b(255, 255, 255));
   }
 
+  // inlier terms are staged in 4 lanes, or 8 with AVX2 (idepth, u, v, dx, dy,
+  // residual, weight, refColor) and pushed into poseAcc as soon as the lanes
+  // are full, so no per-point data is written back to memory.
+  EIGEN_ALIGN_TO_BOUNDARY(32) float lanes[8 * 8];
+  const int laneWidth = cpuHasAVX2FMA() ? 8 : 4;
+  int nLanes = 0;
+  __m128 fxl4 = _mm_set1_ps(fxl);
+  __m128 fyl4 = _mm_set1_ps(fyl);
+  __m128 a4 = _mm_set1_ps(affLL[0]);
+  __m128 b04 = _mm_set1_ps(lastRef_aff_g2l.b);
+  poseAcc.initialize();
+
+  bool inverseCompositional = setting_coarseTrackingMode == 1;
+  Vec8 bIC = Vec8::Zero();
+
   int nl = pc_n_[lvl];
   float *lpc_u = pc_u_[lvl];
   float *lpc_v = pc_v_[lvl];
   float *lpc_idepth = pc_idepth_[lvl];
   float *lpc_color = pc_color_[lvl];
+  float *lpc_J = pc_J_[lvl];
+
+  const int prefetchDist = 8;
+  int maxPrefetchIdx = wl * (hl - 1) - 1;
 
   for (int i = 0; i < nl; i++) {
     float id = lpc_idepth[i];
@@ -706,6 +880,17 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l,
     float Kv = fyl * v + cyl;
     float new_idepth = id / pt[2];
 
+    if (setting_spatialPointOrder && i + prefetchDist < nl) {
+      // points are spatially ordered, so the flow of this point predicts
+      // where a point a few steps ahead lands in the new frame.
+      int pidx = (int)(lpc_u[i + prefetchDist] + Ku - x) +
+                 (int)(lpc_v[i + prefetchDist] + Kv - y) * wl;
+      if (pidx > 0 && pidx < maxPrefetchIdx) {
+        _mm_prefetch((const char *)(dINewl + pidx), _MM_HINT_T0);
+        _mm_prefetch((const char *)(dINewl + pidx + wl), _MM_HINT_T0);
+      }
+    }
+
     if (lvl == 0 && i % 32 == 0) {
       // translation only (positive)
       Vec3f ptT = Ki_[lvl] * Vec3f(x, y, 1) + t * id;
@@ -764,30 +949,46 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l,
       E += hw * residual * residual * (2 - hw);
       numTermsInE++;
 
-      poseBufWarped_idepth[numTermsInWarped] = new_idepth;
-      poseBufWarped_u[numTermsInWarped] = u;
-      poseBufWarped_v[numTermsInWarped] = v;
-      poseBufWarped_dx[numTermsInWarped] = hitColor[1];
-      poseBufWarped_dy[numTermsInWarped] = hitColor[2];
-      poseBufWarped_residual[numTermsInWarped] = residual;
-      poseBufWarped_weight[numTermsInWarped] = hw;
-      poseBufWarped_refColor[numTermsInWarped] = lpc_color[i];
-      numTermsInWarped++;
+      if (inverseCompositional) {
+        bIC += (hw * residual) *
+               Eigen::Map<const Vec8f>(lpc_J + 8 * i).cast<double>();
+        numTermsInWarped++;
+        continue;
+      }
+
+      float *lane = lanes + nLanes;
+      lane[0] = new_idepth;
+      lane[laneWidth] = u;
+      lane[2 * laneWidth] = v;
+      lane[3 * laneWidth] = hitColor[1];
+      lane[4 * laneWidth] = hitColor[2];
+      lane[5 * laneWidth] = residual;
+      lane[6 * laneWidth] = hw;
+      lane[7 * laneWidth] = refColor;
+      if (++nLanes == laneWidth) {
+        if (laneWidth == 8)
+          accumulateGSLanesAVX(poseAcc, lanes, fxl, fyl, affLL[0],
+                               lastRef_aff_g2l.b);
+        else
+          accumulateGSLanes(lanes, fxl4, fyl4, a4, b04);
+        numTermsInWarped += laneWidth;
+        nLanes = 0;
+      }
     }
   }
 
-  while (numTermsInWarped % 4 != 0) {
-    poseBufWarped_idepth[numTermsInWarped] = 0;
-    poseBufWarped_u[numTermsInWarped] = 0;
-    poseBufWarped_v[numTermsInWarped] = 0;
-    poseBufWarped_dx[numTermsInWarped] = 0;
-    poseBufWarped_dy[numTermsInWarped] = 0;
-    poseBufWarped_residual[numTermsInWarped] = 0;
-    poseBufWarped_weight[numTermsInWarped] = 0;
-    poseBufWarped_refColor[numTermsInWarped] = 0;
-    numTermsInWarped++;
+  // zero-weight padding for the last, partially filled lanes.
+  if (nLanes > 0) {
+    for (int k = nLanes; k < laneWidth; k++)
+      for (int j = 0; j < 8; j++)
+        lanes[k + laneWidth * j] = 0;
+    if (laneWidth == 8)
+      accumulateGSLanesAVX(poseAcc, lanes, fxl, fyl, affLL[0],
+                           lastRef_aff_g2l.b);
+    else
+      accumulateGSLanes(lanes, fxl4, fyl4, a4, b04);
+    numTermsInWarped += laneWidth;
   }
-  poseBufWarped_n = numTermsInWarped;
 
   if (plot_img) {
     IOWrap::displayImage("Tracking Residual", resImage, false);
@@ -803,6 +1004,39 @@ Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l,
   rs[4] = sumSquaredShiftRT / (sumSquaredShiftNum + 0.1);
   rs[5] = numSaturated / (float)numTermsInE;
 
+  if (inverseCompositional) {
+    // J = D * J_ref with D = diag(-a, -a, -a, -a, -a, -a, a, 1).
+    Vec8 d;
+    d.head<6>().setConstant(-affLL[0]);
+    d[6] = affLL[0];
+    d[7] = 1;
+    H_out = d.asDiagonal() * H_ic_[lvl] * d.asDiagonal();
+    b_out = d.cwiseProduct(bIC) * (1.0f / numTermsInWarped);
+    b_out.segment<3>(0) *= SCALE_XI_ROT;
+    b_out.segment<3>(3) *= SCALE_XI_TRANS;
+    b_out.segment<1>(6) *= SCALE_A;
+    b_out.segment<1>(7) *= SCALE_B;
+    return rs;
+  }
+
+  poseAcc.finish();
+  int n = numTermsInWarped;
+  H_out = poseAcc.H.topLeftCorner<8, 8>().cast<double>() * (1.0f / n);
+  b_out = poseAcc.H.topRightCorner<8, 1>().cast<double>() * (1.0f / n);
+
+  H_out.block<8, 3>(0, 0) *= SCALE_XI_ROT;
+  H_out.block<8, 3>(0, 3) *= SCALE_XI_TRANS;
+  H_out.block<8, 1>(0, 6) *= SCALE_A;
+  H_out.block<8, 1>(0, 7) *= SCALE_B;
+  H_out.block<3, 8>(0, 0) *= SCALE_XI_ROT;
+  H_out.block<3, 8>(3, 0) *= SCALE_XI_TRANS;
+  H_out.block<1, 8>(6, 0) *= SCALE_A;
+  H_out.block<1, 8>(7, 0) *= SCALE_B;
+  b_out.segment<3>(0) *= SCALE_XI_ROT;
+  b_out.segment<3>(3) *= SCALE_XI_TRANS;
+  b_out.segment<1>(6) *= SCALE_A;
+  b_out.segment<1>(7) *= SCALE_B;
+
   return rs;
 }
 
@@ -811,6 +1045,7 @@ CoarseDistanceMap::CoarseDistanceMap(int ww, int hh) {
 
   bfsList1 = new Eigen::Vector2i[ww * hh / 4];
   bfsList2 = new Eigen::Vector2i[ww * hh / 4];
+  distTransformBuf = new int[ww * hh / 4];
 
   int fac = 1 << (pyrLevelsUsed - 1);
 
@@ -825,6 +1060,7 @@ CoarseDistanceMap::~CoarseDistanceMap() {
   delete[] fwdWarpedIDDistFinal;
   delete[] bfsList1;
   delete[] bfsList2;
+  delete[] distTransformBuf;
   delete[] coarseProjectionGrid;
   delete[] coarseProjectionGridnum;
 }
@@ -861,7 +1097,10 @@ void CoarseDistanceMap::makeDistanceMap(
     }
   }
 
-  growDistBFS(numItems);
+  if (setting_distanceTransform)
+    growDistTransform();
+  else
+    growDistBFS(numItems);
 }
 
 void CoarseDistanceMap::makeInlierVotes(
@@ -869,93 +1108,13 @@ void CoarseDistanceMap::makeInlierVotes(
 
 void CoarseDistanceMap::growDistBFS(int bfsNum) {
   assert(w_[0] != 0);
-  int w1 = w_[1], h1 = h_[1];
-  for (int k = 1; k < 40; k++) {
-    int bfsNum2 = bfsNum;
-    std::swap<Eigen::Vector2i *>(bfsList1, bfsList2);
-    bfsNum = 0;
-
-    if (k % 2 == 0) {
-      for (int i = 0; i < bfsNum2; i++) {
-        int x = bfsList2[i][0];
-        int y = bfsList2[i][1];
-        if (x == 0 || y == 0 || x == w1 - 1 || y == h1 - 1)
-          continue;
-        int idx = x + y * w1;
-
-        if (fwdWarpedIDDistFinal[idx + 1] > k) {
-          fwdWarpedIDDistFinal[idx + 1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx - 1] > k) {
-          fwdWarpedIDDistFinal[idx - 1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx + w1] > k) {
-          fwdWarpedIDDistFinal[idx + w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x, y + 1);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx - w1] > k) {
-          fwdWarpedIDDistFinal[idx - w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x, y - 1);
-          bfsNum++;
-        }
-      }
-    } else {
-      for (int i = 0; i < bfsNum2; i++) {
-        int x = bfsList2[i][0];
-        int y = bfsList2[i][1];
-        if (x == 0 || y == 0 || x == w1 - 1 || y == h1 - 1)
-          continue;
-        int idx = x + y * w1;
-
-        if (fwdWarpedIDDistFinal[idx + 1] > k) {
-          fwdWarpedIDDistFinal[idx + 1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx - 1] > k) {
-          fwdWarpedIDDistFinal[idx - 1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx + w1] > k) {
-          fwdWarpedIDDistFinal[idx + w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x, y + 1);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx - w1] > k) {
-          fwdWarpedIDDistFinal[idx - w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x, y - 1);
-          bfsNum++;
-        }
+  growDistBFSRings(fwdWarpedIDDistFinal, bfsList1, bfsList2, bfsNum, w_[1],
+                   h_[1]);
+}
 
-        if (fwdWarpedIDDistFinal[idx + 1 + w1] > k) {
-          fwdWarpedIDDistFinal[idx + 1 + w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y + 1);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx - 1 + w1] > k) {
-          fwdWarpedIDDistFinal[idx - 1 + w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y + 1);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx - 1 - w1] > k) {
-          fwdWarpedIDDistFinal[idx - 1 - w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y - 1);
-          bfsNum++;
-        }
-        if (fwdWarpedIDDistFinal[idx + 1 - w1] > k) {
-          fwdWarpedIDDistFinal[idx + 1 - w1] = k;
-          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y - 1);
-          bfsNum++;
-        }
-      }
-    }
-  }
+void CoarseDistanceMap::growDistTransform() {
+  assert(w_[0] != 0);
+  growDistTwoPass(fwdWarpedIDDistFinal, distTransformBuf, w_[1], h_[1]);
 }
 
 void CoarseDistanceMap::addIntoDistFinal(int u, int v) {
@@ -966,6 +1125,88 @@ void CoarseDistanceMap::addIntoDistFinal(int u, int v) {
   growDistBFS(1);
 }
 
+// ring BFS distance between two pixels, if the path is not blocked by the
+// image border: max(|du|,|dv|) with 8-neighbour rings, but diagonal steps
+// only in every second ring.
+static EIGEN_ALWAYS_INLINE int ringDistance(int du, int dv) {
+  int a = std::abs(du), b = std::abs(dv);
+  return std::max(std::max(a, b), (2 * (a + b) + 1) / 3);
+}
+
+void CoarseDistanceMap::resetActivationTiles() {
+  assert(w_[0] != 0);
+  activationTilesX = (w_[1] + 31) / 32;
+  activationTilesY = (h_[1] + 31) / 32;
+  int numTiles = activationTilesX * activationTilesY;
+
+  activationCandidates.clear();
+  activationTileCandidates.resize(numTiles);
+  activationTileAccepted.resize(numTiles);
+  for (int i = 0; i < numTiles; i++) {
+    activationTileCandidates[i].clear();
+    activationTileAccepted[i].clear();
+  }
+
+  for (int phase = 0; phase < 4; phase++)
+    activationPhaseTiles[phase].clear();
+  for (int ty = 0; ty < activationTilesY; ty++)
+    for (int tx = 0; tx < activationTilesX; tx++)
+      activationPhaseTiles[(tx & 1) + 2 * (ty & 1)].push_back(
+          tx + ty * activationTilesX);
+}
+
+void CoarseDistanceMap::addActivationCandidate(int u, int v, float dist,
+                                               float subpix, float minDist) {
+  ActivationCandidate c;
+  c.u = u;
+  c.v = v;
+  c.dist = dist;
+  c.subpix = subpix;
+  c.minDist = minDist;
+  c.activate = false;
+  activationTileCandidates[(u >> 5) + (v >> 5) * activationTilesX].push_back(
+      activationCandidates.size());
+  activationCandidates.push_back(c);
+}
+
+// decides the candidates of tiles [min, max) of one phase, in the order they
+// were added. a candidate is rejected if it is closer than its threshold to
+// a point accepted before, in the same tile or in a neighbouring tile of an
+// earlier phase. thresholds are at most 4 * 4 < 32, so only the 3x3
+// neighbouring tiles matter, and those are never decided concurrently.
+void CoarseDistanceMap::decideActivationTiles(int phase, int min, int max,
+                                              Vec10 *stats, int tid) {
+  int w1 = w_[1], h1 = h_[1];
+  for (int t = min; t < max; t++) {
+    int tile = activationPhaseTiles[phase][t];
+    int tx = tile % activationTilesX;
+    int ty = tile / activationTilesX;
+
+    for (int idx : activationTileCandidates[tile]) {
+      ActivationCandidate &c = activationCandidates[idx];
+      float dist = c.dist;
+
+      for (int ny = std::max(0, ty - 1);
+           ny <= std::min(activationTilesY - 1, ty + 1); ny++)
+        for (int nx = std::max(0, tx - 1);
+             nx <= std::min(activationTilesX - 1, tx + 1); nx++)
+          for (int aIdx : activationTileAccepted[nx + ny * activationTilesX]) {
+            const ActivationCandidate &a = activationCandidates[aIdx];
+            // the BFS never grows from border pixels.
+            int ring = (a.u == w1 - 1 || a.v == h1 - 1)
+                           ? ((a.u == c.u && a.v == c.v) ? 0 : 1000)
+                           : ringDistance(c.u - a.u, c.v - a.v);
+            dist = std::min(dist, ring + c.subpix);
+          }
+
+      if (dist >= c.minDist) {
+        c.activate = true;
+        activationTileAccepted[tile].push_back(idx);
+      }
+    }
+  }
+}
+
 void CoarseDistanceMap::makeK(CalibHessian *HCalib) {
   w_[0] = wG[0];
   h_[0] = hG[0];
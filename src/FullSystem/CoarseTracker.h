@@ -48,7 +48,11 @@ public:
 
   void makeK(CalibHessian *HCalib);
 
-  void setCoarseTrackingRef(std::vector<FrameHessian *> frameHessians);
+  // setting the tracking reference is split in two: the snapshot reads the
+  // window and has to run while it is consistent, the build only touches the
+  // snapshot and the reference images and may run on another thread.
+  void snapshotCoarseTrackingRef(std::vector<FrameHessian *> frameHessians);
+  void buildCoarseTrackingRef();
 
   void scaleCoarseDepthL0(float scale);
 
@@ -67,17 +71,36 @@ public:
   AffLight lastRef_aff_g2l;
   Vec3 lastFlowIndicators;
   double firstCoarseRMSE;
+  int lastNumIterations;
+  int lastNumLevels;
+  float medianIdepth; // of the level 0 reference points, 0 if there are none.
 
 private:
-  void makeCoarseDepthL0(std::vector<FrameHessian *> frameHessians);
-
-  Vec6 calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH,
-               bool plot_img = false);
-  void calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew,
-                 AffLight aff_g2l);
+  struct RefPoint {
+    int idx;
+    float idepth;
+    float weight;
+  };
+
+  void makeCoarseDepthL0();
+  void downsampleCoarseDepth(int lvl);
+  void sortCoarsePointsMorton(int lvl);
+  void makeCoarseJacobiansIC();
+
+  // computes residuals, robust weights and the Gauss-Newton system in a single
+  // pass over the point cloud of lvl. in inverse-compositional mode only b is
+  // accumulated (from pc_J_), H is the constant H_ic_ of that level.
+  Vec6 calcResAndGS(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew,
+                    AffLight aff_g2l, float cutoffTH, bool plot_img = false);
+  void accumulateGSLanes(const float *lanes, __m128 fxl, __m128 fyl, __m128 a,
+                         __m128 b0);
 
   std::vector<float *> ptrToDelete;
 
+  std::vector<RefPoint> refPointSnapshot;
+  std::vector<uint64_t> mortonKeys;
+  int snapshotRefFrameID;
+
   float *idepth_[PYR_LEVELS];
   float *weight_sums_[PYR_LEVELS];
   float *weight_sums_bak_[PYR_LEVELS];
@@ -97,16 +120,10 @@ private:
   float *pc_color_[PYR_LEVELS];
   int pc_n_[PYR_LEVELS];
 
-  // warped buffers
-  float *poseBufWarped_idepth;
-  float *poseBufWarped_u;
-  float *poseBufWarped_v;
-  float *poseBufWarped_dx;
-  float *poseBufWarped_dy;
-  float *poseBufWarped_residual;
-  float *poseBufWarped_weight;
-  float *poseBufWarped_refColor;
-  int poseBufWarped_n;
+  // inverse-compositional buffers: 8 reference-side Jacobian entries per pc
+  // point and the unweighted, scaled Hessian of each level.
+  float *pc_J_[PYR_LEVELS];
+  Mat88 H_ic_[PYR_LEVELS];
 
   FrameHessian *newFrame;
   Accumulator9 poseAcc;
@@ -133,6 +150,27 @@ public:
 
   void addIntoDistFinal(int u, int v);
 
+  // tile-parallel activation: candidates that pass the distance map are
+  // collected per 32x32 tile (level 1), then decided tile by tile in four
+  // phases, such that tiles decided concurrently never see each other.
+  struct ActivationCandidate {
+    int u, v;
+    float dist;    // distance map value + subpixel offset.
+    float subpix;  // subpixel offset.
+    float minDist; // activation threshold.
+    bool activate;
+  };
+  std::vector<ActivationCandidate> activationCandidates;
+
+  void resetActivationTiles();
+  void addActivationCandidate(int u, int v, float dist, float subpix,
+                              float minDist);
+  int numActivationTiles(int phase) {
+    return activationPhaseTiles[phase].size();
+  }
+  void decideActivationTiles(int phase, int min, int max, Vec10 *stats,
+                             int tid);
+
 private:
   int w_[PYR_LEVELS];
   int h_[PYR_LEVELS];
@@ -141,8 +179,15 @@ private:
   int *coarseProjectionGridnum;
   Eigen::Vector2i *bfsList1;
   Eigen::Vector2i *bfsList2;
+  int *distTransformBuf;
 
   void growDistBFS(int bfsNum);
+  void growDistTransform();
+
+  int activationTilesX, activationTilesY;
+  std::vector<std::vector<int>> activationTileCandidates;
+  std::vector<std::vector<int>> activationTileAccepted;
+  std::vector<int> activationPhaseTiles[4];
 };
 
 } // namespace dso
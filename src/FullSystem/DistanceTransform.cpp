@@ -0,0 +1,163 @@
+// Copyright (C) <2020> <Jiawei Mo, Junaed Sattar>
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// This file is modified from <https://github.com/JakobEngel/dso>
+
+#include "DistanceTransform.h"
+#include <algorithm>
+
+namespace dso {
+
+void growDistBFSRings(float *dist, Eigen::Vector2i *&bfsList1,
+                      Eigen::Vector2i *&bfsList2, int bfsNum, int w1, int h1) {
+  for (int k = 1; k < 40; k++) {
+    int bfsNum2 = bfsNum;
+    std::swap<Eigen::Vector2i *>(bfsList1, bfsList2);
+    bfsNum = 0;
+
+    if (k % 2 == 0) {
+      for (int i = 0; i < bfsNum2; i++) {
+        int x = bfsList2[i][0];
+        int y = bfsList2[i][1];
+        if (x == 0 || y == 0 || x == w1 - 1 || y == h1 - 1)
+          continue;
+        int idx = x + y * w1;
+
+        if (dist[idx + 1] > k) {
+          dist[idx + 1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y);
+          bfsNum++;
+        }
+        if (dist[idx - 1] > k) {
+          dist[idx - 1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y);
+          bfsNum++;
+        }
+        if (dist[idx + w1] > k) {
+          dist[idx + w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x, y + 1);
+          bfsNum++;
+        }
+        if (dist[idx - w1] > k) {
+          dist[idx - w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x, y - 1);
+          bfsNum++;
+        }
+      }
+    } else {
+      for (int i = 0; i < bfsNum2; i++) {
+        int x = bfsList2[i][0];
+        int y = bfsList2[i][1];
+        if (x == 0 || y == 0 || x == w1 - 1 || y == h1 - 1)
+          continue;
+        int idx = x + y * w1;
+
+        if (dist[idx + 1] > k) {
+          dist[idx + 1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y);
+          bfsNum++;
+        }
+        if (dist[idx - 1] > k) {
+          dist[idx - 1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y);
+          bfsNum++;
+        }
+        if (dist[idx + w1] > k) {
+          dist[idx + w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x, y + 1);
+          bfsNum++;
+        }
+        if (dist[idx - w1] > k) {
+          dist[idx - w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x, y - 1);
+          bfsNum++;
+        }
+
+        if (dist[idx + 1 + w1] > k) {
+          dist[idx + 1 + w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y + 1);
+          bfsNum++;
+        }
+        if (dist[idx - 1 + w1] > k) {
+          dist[idx - 1 + w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y + 1);
+          bfsNum++;
+        }
+        if (dist[idx - 1 - w1] > k) {
+          dist[idx - 1 - w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x - 1, y - 1);
+          bfsNum++;
+        }
+        if (dist[idx + 1 - w1] > k) {
+          dist[idx + 1 - w1] = k;
+          bfsList1[bfsNum] = Eigen::Vector2i(x + 1, y - 1);
+          bfsNum++;
+        }
+      }
+    }
+  }
+}
+
+// step cost of the ring BFS: pixels reached in ring k are expanded in ring
+// k+1, which only includes the diagonal neighbours if k+1 is odd.
+static EIGEN_ALWAYS_INLINE int distDiagStep(int k) {
+  return k + 1 + (k & 1) * 1000;
+}
+
+// computes exactly the same map as growDistBFSRings from all seeds (pixels with
+// distance 0), but with one downward and one upward pass over the rows: the
+// ring BFS distance is a shortest path with the step costs above, and every
+// shortest path can be chosen monotone in y. each pass first propagates from
+// the previous row (branch-free, vectorizes), then along the row in both
+// directions. as in the BFS, border pixels are never propagated from, and
+// distances >= 40 are unreached.
+void growDistTwoPass(float *distMap, int *buf, int w1, int h1) {
+  int *dist = buf;
+  for (int i = 0; i < w1 * h1; i++)
+    dist[i] = distMap[i] == 0 ? 0 : 1000;
+
+  for (int pass = 0; pass < 2; pass++) {
+    for (int r = 1; r < h1; r++) {
+      int y = pass == 0 ? r : h1 - 1 - r;
+      int ys = pass == 0 ? y - 1 : y + 1;
+      int *row = dist + y * w1;
+      const int *src = dist + ys * w1;
+
+      if (ys > 0 && ys < h1 - 1) {
+        row[0] = std::min(row[0], distDiagStep(src[1]));
+        row[1] = std::min(row[1], std::min(src[1] + 1, distDiagStep(src[2])));
+        for (int x = 2; x < w1 - 2; x++)
+          row[x] = std::min(
+              std::min(row[x], src[x] + 1),
+              std::min(distDiagStep(src[x - 1]), distDiagStep(src[x + 1])));
+        row[w1 - 2] = std::min(
+            row[w1 - 2], std::min(src[w1 - 2] + 1, distDiagStep(src[w1 - 3])));
+        row[w1 - 1] = std::min(row[w1 - 1], distDiagStep(src[w1 - 2]));
+      }
+
+      if (y > 0 && y < h1 - 1) {
+        for (int x = 2; x < w1; x++)
+          row[x] = std::min(row[x], row[x - 1] + 1);
+        for (int x = w1 - 3; x >= 0; x--)
+          row[x] = std::min(row[x], row[x + 1] + 1);
+      }
+    }
+  }
+
+  for (int i = 0; i < w1 * h1; i++)
+    distMap[i] = dist[i] < 40 ? dist[i] : 1000;
+}
+
+} // namespace dso
@@ -0,0 +1,36 @@
+// Copyright (C) <2020> <Jiawei Mo, Junaed Sattar>
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// This file is modified from <https://github.com/JakobEngel/dso>
+
+#pragma once
+#include "util/NumType.h"
+
+namespace dso {
+
+// distance maps of CoarseDistanceMap on a w1 x h1 image. dist holds 0 for the
+// seeds, and both functions leave 1..39 for pixels up to 39 rings away and
+// the initial value (1000) beyond; border pixels are never expanded.
+
+// ring BFS from the bfsNum seeds in bfsList1, alternating 4- and
+// 8-neighbour rings. the lists are swapped while growing.
+void growDistBFSRings(float *dist, Eigen::Vector2i *&bfsList1,
+                      Eigen::Vector2i *&bfsList2, int bfsNum, int w1, int h1);
+
+// same map from all seeds in distMap with two passes over the rows, buf is
+// w1 * h1 scratch.
+void growDistTwoPass(float *distMap, int *buf, int w1, int h1);
+
+} // namespace dso
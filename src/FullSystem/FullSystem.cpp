@@ -39,6 +39,7 @@
 #include "ResidualProjections.h"
 #include "stdio.h"
 #include "util/ImageAndExposure.h"
+#include "util/ThreadAffinity.h"
 #include "util/globalCalib.h"
 #include "util/globalFuncs.h"
 
@@ -56,6 +57,9 @@ int PointHessian::instanceCounter = 0;
 int CalibHessian::instanceCounter = 0;
 
 FullSystem::FullSystem() {
+  // frames are fed (tracked and mapped) by the thread that makes the system.
+  pinCurrentThread(setting_cpuTracking);
+
   selectionMap = new float[wG[0] * hG[0]];
 
   coarseDistanceMap = new CoarseDistanceMap(wG[0], hG[0]);
@@ -72,8 +76,15 @@ FullSystem::FullSystem() {
   statistics_numForceDroppedResFwd = 0;
   statistics_numMargResFwd = 0;
   statistics_numMargResBwd = 0;
+  statistics_numTrackTries = 0;
+  statistics_numTrackLevels = 0;
+  statistics_numTraced = 0;
+  statistics_numTraceSkipped = 0;
+  statistics_numTraceGood = 0;
+  statistics_traceGoodInterval = 0;
 
   lastCoarseRMSE.setConstant(100);
+  imuRotError = imuTransError = -1;
 
   currentMinActDist = 2;
   initialized = false;
@@ -91,6 +102,7 @@ FullSystem::FullSystem() {
 }
 
 FullSystem::~FullSystem() {
+  waitForCoarseTrackingRef();
   delete[] selectionMap;
 
   for (FrameShell *s : allFrameHistory)
@@ -140,6 +152,56 @@ void FullSystem::printResult(std::string file) {
   }
   printf("Opt tt: %.1f\n", float(total_opt_tt) / opt_tt.size());
 
+  long total_track_tt = 0, total_track_its = 0;
+  for (unsigned int i = 0; i < track_tt.size(); i++) {
+    total_track_tt += track_tt[i];
+    total_track_its += track_its[i];
+  }
+  printf("Track tt: %.2f ms, %.1f LM its (coarse tracking mode %d)\n",
+         0.001f * total_track_tt / track_tt.size(),
+         float(total_track_its) / track_its.size(), setting_coarseTrackingMode);
+  printf("Track tries: %.2f, levels: %.2f per frame\n",
+         float(statistics_numTrackTries) / track_its.size(),
+         float(statistics_numTrackLevels) / track_its.size());
+
+  long total_distmap_tt = 0;
+  for (int tt : distmap_tt)
+    total_distmap_tt += tt;
+  printf("Distmap tt: %.3f ms (%s)\n",
+         0.001f * total_distmap_tt / distmap_tt.size(),
+         setting_distanceTransform ? "distance transform" : "ring BFS");
+
+  long total_trace_tt = 0;
+  for (int tt : trace_tt)
+    total_trace_tt += tt;
+  printf("Trace tt: %.3f ms\n", 0.001f * total_trace_tt / trace_tt.size());
+  printf("Trace: %.1f points, %.1f skipped by budget per frame, good interval "
+         "%.2f px\n",
+         float(statistics_numTraced) / trace_tt.size(),
+         float(statistics_numTraceSkipped) / trace_tt.size(),
+         statistics_traceGoodInterval /
+             std::max(1.0, (double)statistics_numTraceGood));
+
+  long total_linearize_tt = 0, total_linearize_res = 0;
+  for (unsigned int i = 0; i < linearize_tt.size(); i++) {
+    total_linearize_tt += linearize_tt[i];
+    total_linearize_res += linearize_res[i];
+  }
+  printf("Linearize tt: %.3f ms per 10k residuals (%.0f residuals per call)\n",
+         10.0f * total_linearize_tt / std::max(1L, total_linearize_res),
+         float(total_linearize_res) / linearize_tt.size());
+
+  treadReduce.printStats();
+  ef->printSolverStats();
+
+  ObjectPool<ImmaturePoint>::instance().printStats("ImmaturePoint");
+  ObjectPool<PointHessian>::instance().printStats("PointHessian");
+  ObjectPool<EFPoint>::instance().printStats("EFPoint");
+  ObjectPool<PointFrameResidual>::instance().printStats("PointFrameResidual");
+  ObjectPool<EFResidual>::instance().printStats("EFResidual");
+  ObjectPool<RawResidualJacobian>::instance().printStats(
+      "RawResidualJacobian");
+
   std::ofstream myfile;
   myfile.open(file.c_str());
   myfile << std::setprecision(15);
@@ -198,6 +260,8 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian *fh) {  // todo: 里面有很多SE3
   SE3 fh_2_slast = slast_2_sprelast; // assumed to be the same as fh_2_slast.
 
   SE3 lastF_2_fh_imu;
+  bool imuTrusted = false;
+  int coarsestLvl = pyrLevelsUsed - 1;
   if (setting_enable_imu && HCalib.imu_initialized) {
     // imu predicted motion
     double t = slast->timestamp - fh->shell->timestamp;
@@ -207,9 +271,29 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian *fh) {  // todo: 里面有很多SE3
     SE3 fh_2_w(rot_fh_2_w, tsl_fh_2_w);
     lastF_2_fh_imu = fh_2_w.inverse() * lastF->shell->camToWorld;
     lastF_2_fh_tries.push_back(lastF_2_fh_imu);
+
+    // expected pixel error of the prediction from its recent errors, the
+    // translation taken at the median depth of the reference, with a margin
+    // of 3. the gate is off with setting_imuTrustTH = 0.
+    if (setting_imuTrustTH > 0 && imuRotError >= 0) {
+      float errorPx =
+          3 * HCalib.fxl() *
+          (imuRotError + imuTransError * coarse_tracker_->medianIdepth);
+      imuTrusted = errorPx < setting_imuTrustTH;
+      if (imuTrusted) {
+        // start at the finest level that still converges from that error.
+        coarsestLvl = 1;
+        while (coarsestLvl < pyrLevelsUsed - 1 &&
+               errorPx > setting_coarseConvergeRadius * (1 << coarsestLvl))
+          coarsestLvl++;
+      }
+    }
   }
   // assume constant motion.  匀速运动
   lastF_2_fh_tries.push_back(fh_2_slast.inverse() * lastF_2_slast);
+  // with a trusted imu, only the two predictions above are tracked unless
+  // their residual is bad.
+  unsigned int numGatedTries = imuTrusted ? 2 : 0;
   // assume double motion (frame skipped)  倍速运动
   lastF_2_fh_tries.push_back(fh_2_slast.inverse() * fh_2_slast.inverse() *
                              lastF_2_slast);
@@ -247,6 +331,8 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian *fh) {  // todo: 里面有很多SE3
   if (!slast->poseValid || !sprelast->poseValid || !lastF->shell->poseValid) {
     lastF_2_fh_tries.clear();
     lastF_2_fh_tries.push_back(SE3());
+    numGatedTries = 0;
+    coarsestLvl = pyrLevelsUsed - 1;
   }
 
   Vec3 flowVecs = Vec3(100, 100, 100);
@@ -261,15 +347,27 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian *fh) {  // todo: 里面有很多SE3
   Vec5 achievedRes = Vec5::Constant(NAN);
   bool haveOneGood = false;
   int tryIterations = 0;
+  int lmIterations = 0;
   for (unsigned int i = 0; i < lastF_2_fh_tries.size(); i++) {
+    if (i > 0 && i == numGatedTries) {
+      if (haveOneGood && achievedRes[0] < lastCoarseRMSE[0] *
+                                              setting_reTrackThreshold *
+                                              setting_imuFallbackFac)
+        break;
+      // imu predictions are bad, fall back to all initializations.
+      coarsestLvl = pyrLevelsUsed - 1;
+    }
+
     AffLight aff_g2l_this = aff_last_2_l;
     SE3 lastF_2_fh_this = lastF_2_fh_tries[i];
     Vec5 currentRes;
     bool trackingIsGood = coarse_tracker_->trackNewestCoarse(
-        fh, lastF_2_fh_this, aff_g2l_this, pyrLevelsUsed - 1, achievedRes,
+        fh, lastF_2_fh_this, aff_g2l_this, coarsestLvl, achievedRes,
         currentRes); // in each level has to be at least as good as the last
                      // try.
     tryIterations++;
+    lmIterations += coarse_tracker_->lastNumIterations;
+    statistics_numTrackLevels += coarse_tracker_->lastNumLevels;
 
     // if (i != 0) {
     //   printf("RE-TRACK ATTEMPT %d with initOption %d and start-lvl "
@@ -326,7 +424,19 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian *fh) {  // todo: 里面有很多SE3
     lastF_2_fh = lastF_2_fh_tries[0];
   }
 
+  if (setting_enable_imu && HCalib.imu_initialized && haveOneGood) {
+    SE3 error = lastF_2_fh_imu.inverse() * lastF_2_fh;
+    double rotError = error.so3().log().norm();
+    double transError = error.translation().norm();
+    imuRotError =
+        imuRotError < 0 ? rotError : 0.5 * (imuRotError + rotError);
+    imuTransError =
+        imuTransError < 0 ? transError : 0.5 * (imuTransError + transError);
+  }
+
   lastCoarseRMSE = achievedRes;
+  track_its.push_back(lmIterations);
+  statistics_numTrackTries += tryIterations;
 
   // no lock required, as fh is not used anywhere yet.
   fh->shell->camToTrackingRef = lastF_2_fh.inverse();
@@ -347,9 +457,8 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian *fh) {  // todo: 里面有很多SE3
 
 void FullSystem::traceNewCoarse(FrameHessian *fh) {
   boost::unique_lock<boost::mutex> lock(mapMutex);
+  auto trace_start = std::chrono::steady_clock::now();
 
-  int trace_total = 0, trace_good = 0, trace_oob = 0, trace_out = 0,
-      trace_skip = 0, trace_badcondition = 0, trace_uninitialized = 0;
 
   Mat33f K = Mat33f::Identity();
   K(0, 0) = HCalib.fxl();
@@ -357,56 +466,135 @@ void FullSystem::traceNewCoarse(FrameHessian *fh) {
   K(0, 2) = HCalib.cxl();
   K(1, 2) = HCalib.cyl();
 
-  for (FrameHessian *host : frameHessians) // go through all active frames
+  traceList.clear();
+  traceListHost.clear();
+  traceKRKi.resize(frameHessians.size());
+  traceKt.resize(frameHessians.size());
+  traceAff.resize(frameHessians.size());
+  for (unsigned int h = 0; h < frameHessians.size();
+       h++) // go through all active frames
   {
+    FrameHessian *host = frameHessians[h];
 
     SE3 hostToNew = fh->PRE_worldToCam * host->PRE_camToWorld;  //! 利用之前（怎么得到的）的位姿, 计算host到new的位姿
-    Mat33f KRKi = K * hostToNew.rotationMatrix().cast<float>() * K.inverse();
-    Vec3f Kt = K * hostToNew.translation().cast<float>();
+    traceKRKi[h] = K * hostToNew.rotationMatrix().cast<float>() * K.inverse();
+    traceKt[h] = K * hostToNew.translation().cast<float>();
 
-    Vec2f aff = AffLight::fromToVecExposure(host->ab_exposure, fh->ab_exposure,
-                                            host->aff_g2l(), fh->aff_g2l())
-                    .cast<float>();
+    traceAff[h] = AffLight::fromToVecExposure(host->ab_exposure,
+                                              fh->ab_exposure,
+                                              host->aff_g2l(), fh->aff_g2l())
+                      .cast<float>();
 
+    // points of all hosts go into one list, so the work is balanced over
+    // threads independent of how many points each host has.
     for (ImmaturePoint *ph : host->immaturePoints) {
-      ph->traceOn(fh, KRKi, Kt, aff, &HCalib, false);
-
-      if (ph->lastTraceStatus == ImmaturePointStatus::IPS_GOOD)
-        trace_good++;
-      if (ph->lastTraceStatus == ImmaturePointStatus::IPS_BADCONDITION)
-        trace_badcondition++;
-      if (ph->lastTraceStatus == ImmaturePointStatus::IPS_OOB)
-        trace_oob++;
-      if (ph->lastTraceStatus == ImmaturePointStatus::IPS_OUTLIER)
-        trace_out++;
-      if (ph->lastTraceStatus == ImmaturePointStatus::IPS_SKIPPED)
-        trace_skip++;
-      if (ph->lastTraceStatus == ImmaturePointStatus::IPS_UNINITIALIZED)
-        trace_uninitialized++;
-      trace_total++;
+      traceList.push_back(ph);
+      traceListHost.push_back(h);
     }
   }
+
+  // with a point budget, trace only the points with the highest priority.
+  // the others keep their last trace result, and rise in priority.
+  if (setting_traceBudget > 0 && (int)traceList.size() > setting_traceBudget) {
+    std::vector<std::pair<float, int>> priorities(traceList.size());
+    for (unsigned int k = 0; k < traceList.size(); k++)
+      priorities[k] = std::make_pair(-traceList[k]->tracePriority(), (int)k);
+    std::nth_element(priorities.begin(),
+                     priorities.begin() + setting_traceBudget,
+                     priorities.end());
+
+    std::vector<int> selected(setting_traceBudget);
+    for (int k = 0; k < setting_traceBudget; k++)
+      selected[k] = priorities[k].second;
+    for (unsigned int k = setting_traceBudget; k < priorities.size(); k++)
+      traceList[priorities[k].second]->traceSkipCount++;
+    std::sort(selected.begin(), selected.end());
+
+    statistics_numTraceSkipped += traceList.size() - setting_traceBudget;
+    for (int k = 0; k < setting_traceBudget; k++) {
+      traceList[k] = traceList[selected[k]];
+      traceListHost[k] = traceListHost[selected[k]];
+    }
+    traceList.resize(setting_traceBudget);
+    traceListHost.resize(setting_traceBudget);
+  }
+
+  Vec10 stats;
+  if (multiThreading) {
+    treadReduce.reduce(boost::bind(&FullSystem::traceNewCoarse_Reductor, this,
+                                   fh, _1, _2, _3, _4),
+                       0, traceList.size(), 50);
+    stats = treadReduce.stats;
+  } else {
+    stats.setZero();
+    traceNewCoarse_Reductor(fh, 0, traceList.size(), &stats, 0);
+  }
+
+  // stats: good, badcondition, oob, out, skip, uninitialized, total.
+  int trace_total = stats[6], trace_good = stats[0];
+  statistics_numTraced += trace_total;
+  statistics_numTraceGood += trace_good;
+  statistics_traceGoodInterval += stats[7];
+
+  auto trace_end = std::chrono::steady_clock::now();
+  trace_tt.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                         trace_end - trace_start)
+                         .count());
   //	printf("ADD: TRACE: %'d points. %'d (%.0f%%) good. %'d (%.0f%%) skip.
   //%'d (%.0f%%) badcond. %'d (%.0f%%) oob. %'d (%.0f%%) out. %'d (%.0f%%)
   // uninit.\n", 			trace_total, trace_good,
-  // 100*trace_good/(float)trace_total, 			trace_skip,
-  // 100*trace_skip/(float)trace_total, trace_badcondition,
-  // 100*trace_badcondition/(float)trace_total, trace_oob,
-  // 100*trace_oob/(float)trace_total, 			trace_out,
-  // 100*trace_out/(float)trace_total, 			trace_uninitialized,
-  // 100*trace_uninitialized/(float)trace_total);
+  // 100*trace_good/(float)trace_total, 			(int)stats[4],
+  // 100*stats[4]/trace_total, (int)stats[1],
+  // 100*stats[1]/trace_total, (int)stats[2],
+  // 100*stats[2]/trace_total, 			(int)stats[3],
+  // 100*stats[3]/trace_total, 			(int)stats[5],
+  // 100*stats[5]/trace_total);
+}
+
+void FullSystem::traceNewCoarse_Reductor(FrameHessian *fh, int min, int max,
+                                         Vec10 *stats, int tid) {
+  for (int k = min; k < max; k++) {
+    ImmaturePoint *ph = traceList[k];
+    int h = traceListHost[k];
+    ph->traceOn(fh, traceKRKi[h], traceKt[h], traceAff[h], &HCalib, false);
+    ph->traceSkipCount = 0;
+
+    if (ph->lastTraceStatus == ImmaturePointStatus::IPS_GOOD) {
+      (*stats)[0]++;
+      (*stats)[7] += ph->lastTracePixelInterval;
+    }
+    if (ph->lastTraceStatus == ImmaturePointStatus::IPS_BADCONDITION)
+      (*stats)[1]++;
+    if (ph->lastTraceStatus == ImmaturePointStatus::IPS_OOB)
+      (*stats)[2]++;
+    if (ph->lastTraceStatus == ImmaturePointStatus::IPS_OUTLIER)
+      (*stats)[3]++;
+    if (ph->lastTraceStatus == ImmaturePointStatus::IPS_SKIPPED)
+      (*stats)[4]++;
+    if (ph->lastTraceStatus == ImmaturePointStatus::IPS_UNINITIALIZED)
+      (*stats)[5]++;
+    (*stats)[6]++;
+  }
 }
 
 void FullSystem::activatePointsMT_Reductor(
-    std::vector<PointHessian *> *optimized,
+    std::vector<ImmaturePointActivation> *optimized,
     std::vector<ImmaturePoint *> *toOptimize, int min, int max, Vec10 *stats,
     int tid) {
-  ImmaturePointTemporaryResidual *tr =
-      new ImmaturePointTemporaryResidual[frameHessians.size()];
-  for (int k = min; k < max; k++) {
-    (*optimized)[k] = optimizeImmaturePoint((*toOptimize)[k], 1, tr);
+  ImmaturePointTemporaryResidual *tr = activationScratch[tid].data();
+  for (int k = min; k < max;) {
+    // batch up to four consecutive points of the same host.
+    int n = 1;
+    while (n < 4 && k + n < max &&
+           (*toOptimize)[k + n]->host == (*toOptimize)[k]->host)
+      n++;
+
+    if (n == 1)
+      (*optimized)[k] = optimizeImmaturePoint((*toOptimize)[k], 1, tr);
+    else
+      optimizeImmaturePointsSSE(&(*toOptimize)[k], n, 1, tr, &(*optimized)[k]);
+    k += n;
   }
-  delete[] tr;
 }
 
 void FullSystem::activatePointsMT() {
@@ -442,12 +630,22 @@ void FullSystem::activatePointsMT() {
 
   // make dist map.
   coarseDistanceMap->makeK(&HCalib);
+  auto distmap_start = std::chrono::steady_clock::now();
   coarseDistanceMap->makeDistanceMap(frameHessians, newestHs);
+  auto distmap_end = std::chrono::steady_clock::now();
+  distmap_tt.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                           distmap_end - distmap_start)
+                           .count());
 
   // coarse_tracker_->debugPlotDistMap("distMap");
 
   std::vector<ImmaturePoint *> toOptimize;
   toOptimize.reserve(20000);
+  std::vector<ImmaturePoint *> candidates;
+  if (setting_tileActivation) {
+    candidates.reserve(20000);
+    coarseDistanceMap->resetActivationTiles();
+  }
 
   for (FrameHessian *host : frameHessians) // go through all active frames
   {
@@ -505,12 +703,19 @@ void FullSystem::activatePointsMT() {
 
       if ((u > 0 && v > 0 && u < wG[1] && v < hG[1])) {
 
-        float dist = coarseDistanceMap->fwdWarpedIDDistFinal[u + wG[1] * v] +
-                     (ptp[0] - floorf((float)(ptp[0])));
+        float subpix = ptp[0] - floorf((float)(ptp[0]));
+        float dist =
+            coarseDistanceMap->fwdWarpedIDDistFinal[u + wG[1] * v] + subpix;
 
         if (dist >= currentMinActDist * ph->my_type) {
-          coarseDistanceMap->addIntoDistFinal(u, v);
-          toOptimize.push_back(ph);
+          if (setting_tileActivation) {
+            coarseDistanceMap->addActivationCandidate(
+                u, v, dist, subpix, currentMinActDist * ph->my_type);
+            candidates.push_back(ph);
+          } else {
+            coarseDistanceMap->addIntoDistFinal(u, v);
+            toOptimize.push_back(ph);
+          }
         }
       } else {
         delete ph;
@@ -519,12 +724,31 @@ void FullSystem::activatePointsMT() {
     }
   }
 
+  if (setting_tileActivation) {
+    for (int phase = 0; phase < 4; phase++) {
+      int numTiles = coarseDistanceMap->numActivationTiles(phase);
+      if (multiThreading)
+        treadReduce.reduce(
+            boost::bind(&CoarseDistanceMap::decideActivationTiles,
+                        coarseDistanceMap, phase, _1, _2, _3, _4),
+            0, numTiles, 1);
+      else
+        coarseDistanceMap->decideActivationTiles(phase, 0, numTiles, 0, 0);
+    }
+    for (unsigned int i = 0; i < candidates.size(); i++)
+      if (coarseDistanceMap->activationCandidates[i].activate)
+        toOptimize.push_back(candidates[i]);
+  }
+
   //	printf("ACTIVATE: %d. (del %d, notReady %d, marg %d, good %d, marg-skip
   //%d)\n", 			(int)toOptimize.size(), immature_deleted,
   // immature_notReady, immature_needMarg, immature_want, immature_margskip);
 
-  std::vector<PointHessian *> optimized;
+  std::vector<ImmaturePointActivation> optimized;
   optimized.resize(toOptimize.size());
+  for (int i = 0; i < setting_numThreads; i++)
+    if (activationScratch[i].size() < 4 * frameHessians.size())
+      activationScratch[i].resize(4 * frameHessians.size());
 
   if (multiThreading)
     treadReduce.reduce(boost::bind(&FullSystem::activatePointsMT_Reductor, this,
@@ -535,9 +759,28 @@ void FullSystem::activatePointsMT() {
     activatePointsMT_Reductor(&optimized, &toOptimize, 0, toOptimize.size(), 0,
                               0);
 
+  // create all points and residuals in one batch, from pools that are filled
+  // up front.
+  int numNewPoints = 0, numNewResiduals = 0;
+  for (const ImmaturePointActivation &act : optimized)
+    if (act.status == 1) {
+      numNewPoints++;
+      for (unsigned int bits = act.goodTargets; bits != 0; bits &= bits - 1)
+        numNewResiduals++;
+    }
+  ObjectPool<PointHessian>::instance().reserve(numNewPoints);
+  ObjectPool<EFPoint>::instance().reserve(numNewPoints);
+  ObjectPool<PointFrameResidual>::instance().reserve(numNewResiduals);
+  ObjectPool<EFResidual>::instance().reserve(numNewResiduals);
+  ObjectPool<RawResidualJacobian>::instance().reserve(
+      2 * numNewResiduals); // one for the residual, one for its EFResidual.
+
   for (unsigned k = 0; k < toOptimize.size(); k++) {
-    PointHessian *newpoint = optimized[k];
     ImmaturePoint *ph = toOptimize[k];
+    PointHessian *newpoint =
+        optimized[k].status == 1
+            ? makeActivatedPoint(ph, optimized[k])
+            : (optimized[k].status == 0 ? 0 : (PointHessian *)((long)(-1)));
 
     if (newpoint != 0 && newpoint != (PointHessian *)((long)(-1))) {
       newpoint->host->immaturePoints[ph->idxInImmaturePoints] = 0;
@@ -564,9 +807,25 @@ void FullSystem::activatePointsMT() {
         i--;
       }
     }
+
+    if (setting_spatialPointOrder)
+      sortPointsMorton(host);
   }
 }
 
+void FullSystem::sortPointsMorton(FrameHessian *host) {
+  // removal swaps with the back, so the order decays between keyframes;
+  // restore it once after activation.
+  std::vector<std::pair<uint32_t, PointHessian *>> keys;
+  keys.reserve(host->pointHessians.size());
+  for (PointHessian *ph : host->pointHessians)
+    keys.push_back(std::make_pair(mortonCode((uint32_t)ph->u, (uint32_t)ph->v),
+                                  ph));
+  std::sort(keys.begin(), keys.end());
+  for (unsigned int i = 0; i < keys.size(); i++)
+    host->pointHessians[i] = keys[i].second;
+}
+
 void FullSystem::activatePointsOldFirst() { assert(false); }
 
 void FullSystem::flagPointsForRemoval() {
@@ -706,6 +965,7 @@ void FullSystem::addActiveFrame(const std::vector<Vec7> &new_imu_data,
   } else // do front-end operation.
   {
     // SWAP tracking reference?.
+    waitForCoarseTrackingRef();
     if (coarse_tracker_for_new_kf_->refFrameID > coarse_tracker_->refFrameID) {
       boost::unique_lock<boost::mutex> crlock(coarseTrackerSwapMutex);
       CoarseTracker *tmp = coarse_tracker_;
@@ -718,7 +978,12 @@ void FullSystem::addActiveFrame(const std::vector<Vec7> &new_imu_data,
                             coarse_tracker_->lastRef->imu_bias, &HCalib);
     }
 
+    auto track_start = std::chrono::steady_clock::now();
     Vec4 tres = trackNewCoarse(fh);   // 跟踪当前帧
+    auto track_end = std::chrono::steady_clock::now();
+    track_tt.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                           track_end - track_start)
+                           .count());
     if (!std::isfinite((double)tres[0]) || !std::isfinite((double)tres[1]) ||
         !std::isfinite((double)tres[2]) || !std::isfinite((double)tres[3])) {
       printf("Initial Tracking failed: LOST!\n");
@@ -832,6 +1097,13 @@ void FullSystem::makeKeyFrame(FrameHessian *fh) {
 
   // add new residuals for old points
   int numFwdResAdde = 0;
+  int numFwdRes = 0;
+  for (FrameHessian *fh1 : frameHessians)
+    if (fh1 != fh)
+      numFwdRes += fh1->pointHessians.size();
+  ObjectPool<PointFrameResidual>::instance().reserve(numFwdRes);
+  ObjectPool<EFResidual>::instance().reserve(numFwdRes);
+  ObjectPool<RawResidualJacobian>::instance().reserve(2 * numFwdRes);
   for (FrameHessian *fh1 : frameHessians) // go through all active frames
   {
     if (fh1 == fh)
@@ -907,16 +1179,21 @@ void FullSystem::makeKeyFrame(FrameHessian *fh) {
     }
   }
 
+  waitForCoarseTrackingRef();
   {
     boost::unique_lock<boost::mutex> crlock(coarseTrackerSwapMutex);
     coarse_tracker_for_new_kf_->makeK(&HCalib);
-    coarse_tracker_for_new_kf_->setCoarseTrackingRef(frameHessians);
-
-    coarse_tracker_for_new_kf_->debugPlotIDepthMap(
-        &minIdJetVisTracker, &maxIdJetVisTracker, outputWrapper);
-    coarse_tracker_for_new_kf_->debugPlotIDepthMapFloat(outputWrapper);
+    coarse_tracker_for_new_kf_->snapshotCoarseTrackingRef(frameHessians);
   }
 
+  // the idepth pyramid and pc buffers only depend on the snapshot, build them
+  // while the rest of the keyframe is processed.
+  if (multiThreading)
+    coarseTrackerRefThread =
+        boost::thread(&FullSystem::buildCoarseTrackingRefThread, this);
+  else
+    buildCoarseTrackingRef();
+
   // debugPlot("post Optimize");
 
   //! (Activate-)Marginalize Points
@@ -946,6 +1223,27 @@ void FullSystem::makeKeyFrame(FrameHessian *fh) {
   // }
 }
 
+// entry of the thread started in makeKeyFrame. only this thread is pinned,
+// without multiThreading buildCoarseTrackingRef runs on the tracking thread.
+void FullSystem::buildCoarseTrackingRefThread() {
+  pinCurrentThread(setting_cpuMapping);
+  buildCoarseTrackingRef();
+}
+
+void FullSystem::buildCoarseTrackingRef() {
+  boost::unique_lock<boost::mutex> crlock(coarseTrackerSwapMutex);
+  coarse_tracker_for_new_kf_->buildCoarseTrackingRef();
+
+  coarse_tracker_for_new_kf_->debugPlotIDepthMap(
+      &minIdJetVisTracker, &maxIdJetVisTracker, outputWrapper);
+  coarse_tracker_for_new_kf_->debugPlotIDepthMapFloat(outputWrapper);
+}
+
+void FullSystem::waitForCoarseTrackingRef() {
+  if (coarseTrackerRefThread.joinable())
+    coarseTrackerRefThread.join();
+}
+
 void FullSystem::initializeFromInitializer(FrameHessian *newFrame) {
   boost::unique_lock<boost::mutex> lock(mapMutex);
 
@@ -1079,6 +1377,7 @@ void FullSystem::makeNewTraces(FrameHessian *newFrame, float *gtDepth) {
   // fh->pointHessiansInactive.reserve(numPointsTotal*1.2f);
   newFrame->pointHessiansMarginalized.reserve(numPointsTotal * 1.2f);
   newFrame->pointHessiansOut.reserve(numPointsTotal * 1.2f);
+  ObjectPool<ImmaturePoint>::instance().reserve(numPointsTotal);
 
   for (int y = patternPadding + 1; y < hG[0] - patternPadding - 2; y++)
     for (int x = patternPadding + 1; x < wG[0] - patternPadding - 2; x++) {
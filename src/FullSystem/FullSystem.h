@@ -32,6 +32,7 @@
 #include "CoarseInitializer.h"
 #include "CoarseTracker.h"
 #include "HessianBlocks.h"
+#include "ImmaturePoint.h"
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "PixelSelector2.h"
 #include "Residuals.h"
@@ -153,9 +154,15 @@ private:
 
   // opt single point
   int optimizePoint(PointHessian *point, int minObs, bool flagOOB);
-  PointHessian *
+  ImmaturePointActivation
   optimizeImmaturePoint(ImmaturePoint *point, int minObs,
                         ImmaturePointTemporaryResidual *residuals);
+  void optimizeImmaturePointsSSE(ImmaturePoint *const *points, int n,
+                                 int minObs,
+                                 ImmaturePointTemporaryResidual *residuals,
+                                 ImmaturePointActivation *acts);
+  PointHessian *makeActivatedPoint(ImmaturePoint *point,
+                                   const ImmaturePointActivation &act);
 
   double linAllPointSinle(PointHessian *point, float outlierTHSlack, bool plot);
 
@@ -165,6 +172,7 @@ private:
   void activatePoints();
   void activatePointsMT();
   void activatePointsOldFirst();
+  void sortPointsMorton(FrameHessian *host);
   void flagPointsForRemoval();
   void makeNewTraces(FrameHessian *newFrame, float *gtDepth);
   void initializeFromInitializer(FrameHessian *newFrame);
@@ -177,6 +185,7 @@ private:
 
   // solce. eventually migrate to ef.
   void solveSystem(int iteration, double lambda);
+  void collectActiveResiduals(int &numPoints, int &numLRes);
   Vec3 linearizeAll(bool fixLinearization);
   bool doStepFromBackup(float stepfacC, float stepfacT, float stepfacR,
                         float stepfacA, float stepfacD);
@@ -187,9 +196,12 @@ private:
   void linearizeAll_Reductor(bool fixLinearization,
                              std::vector<PointFrameResidual *> *toRemove,
                              int min, int max, Vec10 *stats, int tid);
-  void activatePointsMT_Reductor(std::vector<PointHessian *> *optimized,
-                                 std::vector<ImmaturePoint *> *toOptimize,
-                                 int min, int max, Vec10 *stats, int tid);
+  void activatePointsMT_Reductor(
+      std::vector<ImmaturePointActivation> *optimized,
+      std::vector<ImmaturePoint *> *toOptimize, int min, int max, Vec10 *stats,
+      int tid);
+  void traceNewCoarse_Reductor(FrameHessian *fh, int min, int max,
+                               Vec10 *stats, int tid);
   void applyRes_Reductor(bool copyJacobians, int min, int max, Vec10 *stats,
                          int tid);
 
@@ -214,6 +226,12 @@ private:
   long int statistics_numForceDroppedResFwd;
   long int statistics_numMargResFwd;
   long int statistics_numMargResBwd;
+  long int statistics_numTrackTries;
+  long int statistics_numTrackLevels;
+  long int statistics_numTraced;
+  long int statistics_numTraceSkipped;
+  long int statistics_numTraceGood;
+  double statistics_traceGoodInterval;
   float statistics_lastFineTrackRMSE;
 
   // changed by tracker-thread. protected by trackMutex
@@ -221,6 +239,10 @@ private:
   std::vector<FrameShell *> allFrameHistory;
   CoarseInitializer *coarseInitializer;
   Vec5 lastCoarseRMSE;
+  // running rotation (rad) and translation error of the imu prediction, <0 if
+  // unknown.
+  double imuRotError;
+  double imuTransError;
 
   // changed by mapper-thread. protected by mapMutex
   boost::mutex mapMutex;
@@ -236,6 +258,10 @@ private:
   std::vector<FrameHessian *>
       frameHessians; // ONLY changed in marginalizeFrame and addFrame.
   std::vector<PointFrameResidual *> activeResiduals;
+  // activeResiduals[activeResidualBlocks[b] .. activeResidualBlocks[b+1]]
+  // share host and target; linearizeAll is scheduled by block.
+  std::vector<int> activeResidualBlocks;
+  std::vector<int> activeResidualOffsets; // per-target scratch for the above
   float currentMinActDist;
 
   std::vector<float> allResVec;
@@ -249,6 +275,9 @@ private:
                                              // by [coarseTrackerSwapMutex].
   CoarseTracker *coarse_tracker_;            // always used to track new frames.
                                              // protected by [trackMutex].
+  boost::thread coarseTrackerRefThread; // builds the reference of
+                                        // [coarse_tracker_for_new_kf_]; joined
+                                        // before the trackers are swapped.
   float minIdJetVisTracker, maxIdJetVisTracker;
   float minIdJetVisDebug, maxIdJetVisDebug;
 
@@ -262,8 +291,28 @@ private:
 
   std::vector<Vec7> imu_data;
   std::vector<int> opt_tt;
+  std::vector<int> track_tt; // coarse tracking time per frame (us)
+  std::vector<int> track_its; // coarse tracking LM iterations per frame
+  std::vector<int> distmap_tt; // coarse distance map time per keyframe (us)
+  std::vector<int> trace_tt;   // immature point tracing time per frame (us)
+  std::vector<int> linearize_tt;  // residual linearization time per call (us)
+  std::vector<int> linearize_res; // residuals linearized per call
+
+  // immature points traced on the new frame, flattened over all hosts, and
+  // the per-host projection into the new frame.
+  std::vector<ImmaturePoint *> traceList;
+  std::vector<int> traceListHost;
+  std::vector<Mat33f> traceKRKi;
+  std::vector<Vec3f> traceKt;
+  std::vector<Vec2f> traceAff;
+
+  // per-thread scratch for optimizeImmaturePoint, reused over keyframes.
+  std::vector<ImmaturePointTemporaryResidual> activationScratch[NUM_THREADS];
 
   void makeKeyFrame(FrameHessian *fh);
+  void buildCoarseTrackingRef();
+  void buildCoarseTrackingRefThread();
+  void waitForCoarseTrackingRef();
   void makeNonKeyFrame(FrameHessian *fh);
   void deliverTrackedFrame(FrameHessian *fh, bool needKF);
   void mappingLoop();
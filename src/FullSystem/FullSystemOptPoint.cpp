@@ -44,9 +44,14 @@
 
 namespace dso {
 
-PointHessian *
+ImmaturePointActivation
 FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
                                   ImmaturePointTemporaryResidual *residuals) {
+  ImmaturePointActivation act;
+  act.status = 0;
+  act.idepth = NAN;
+  act.goodTargets = 0;
+
   int nres = 0;
   for (FrameHessian *fh : frameHessians) {
     if (fh != point->host) {
@@ -58,6 +63,7 @@ FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
     }
   }
   assert(nres == ((int)frameHessians.size()) - 1);
+  assert(nres <= 32);
 
   bool print = false; // rand()%50==0;
 
@@ -77,7 +83,7 @@ FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
     if (print)
       printf("OptPoint: Not well-constrained (%d res, H=%.1f). E=%f. SKIP!\n",
              nres, lastHdd, lastEnergy);
-    return 0;
+    return act;
   }
 
   if (print)
@@ -104,7 +110,7 @@ FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
       if (print)
         printf("OptPoint: Not well-constrained (%d res, H=%.1f). E=%f. SKIP!\n",
                nres, newHdd, lastEnergy);
-      return 0;
+      return act;
     }
 
     if (print)
@@ -134,22 +140,176 @@ FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
   if (!std::isfinite(currentIdepth)) {
     printf("MAJOR ERROR! point idepth is nan after initialization (%f).\n",
            currentIdepth);
-    return (PointHessian *)((
-        long)(-1)); // yeah I'm like 99% sure this is OK on 32bit systems.
+    act.status = -1;
+    return act;
   }
 
   int numGoodRes = 0;
   for (int i = 0; i < nres; i++)
-    if (residuals[i].state_state == ResState::IN)
+    if (residuals[i].state_state == ResState::IN) {
       numGoodRes++;
+      act.goodTargets |= 1u << i;
+    }
 
   if (numGoodRes < minObs) {
     if (print)
       printf("OptPoint: OUTLIER!\n");
-    return (PointHessian *)((
-        long)(-1)); // yeah I'm like 99% sure this is OK on 32bit systems.
+    act.status = -1;
+    return act;
+  }
+
+  act.status = 1;
+  act.idepth = currentIdepth;
+  return act;
+}
+
+/*
+ * optimizeImmaturePoint for up to four points of the same host at once: the
+ * residuals of all points against one target are linearized together in SSE
+ * lanes, while damping, acceptance and convergence are tracked per point.
+ * residuals holds frameHessians.size() entries per point.
+ */
+void FullSystem::optimizeImmaturePointsSSE(
+    ImmaturePoint *const *points, int n, int minObs,
+    ImmaturePointTemporaryResidual *residuals, ImmaturePointActivation *acts) {
+  assert(n >= 1 && n <= 4);
+  FrameHessian *host = points[0]->host;
+  int stride = frameHessians.size();
+
+  int nres = 0;
+  for (FrameHessian *fh : frameHessians) {
+    if (fh != host) {
+      for (int l = 0; l < n; l++) {
+        ImmaturePointTemporaryResidual &r = residuals[l * stride + nres];
+        r.state_NewEnergy = r.state_energy = 0;
+        r.state_NewState = ResState::OUTLIER;
+        r.state_state = ResState::IN;
+        r.target = fh;
+      }
+      nres++;
+    }
+  }
+  assert(nres <= 32);
+
+  float lastEnergy[4] = {0, 0, 0, 0}, lastHdd[4] = {0, 0, 0, 0},
+        lastbd[4] = {0, 0, 0, 0};
+  float currentIdepth[4], lambda[4];
+  int active = 0; // points still iterating.
+  for (int l = 0; l < n; l++) {
+    assert(points[l]->host == host);
+    acts[l].status = 0;
+    acts[l].idepth = NAN;
+    acts[l].goodTargets = 0;
+    currentIdepth[l] = (points[l]->idepth_max + points[l]->idepth_min) * 0.5f;
+    lambda[l] = 0.1;
+    active |= 1 << l;
+  }
+
+  ImmaturePointTemporaryResidual *tmpRes[4];
+  float energy[4];
+  for (int i = 0; i < nres; i++) {
+    for (int l = 0; l < n; l++)
+      tmpRes[l] = residuals + l * stride + i;
+    ImmaturePoint::linearizeResidualSSE(points, active, &HCalib, 1000, tmpRes,
+                                        lastHdd, lastbd, currentIdepth,
+                                        energy);
+    for (int l = 0; l < n; l++) {
+      lastEnergy[l] += energy[l];
+      tmpRes[l]->state_state = tmpRes[l]->state_NewState;
+      tmpRes[l]->state_energy = tmpRes[l]->state_NewEnergy;
+    }
+  }
+
+  int converged = 0; // points that leave the LM loop early but go on.
+  for (int l = 0; l < n; l++)
+    if (!std::isfinite(lastEnergy[l]) || lastHdd[l] < setting_minIdepthH_act)
+      active &= ~(1 << l); // not well-constrained: status 0.
+
+  for (int iteration = 0;
+       iteration < setting_GNItsOnPointActivation && active != 0;
+       iteration++) {
+    float step[4], newIdepth[4];
+    float newHdd[4] = {0, 0, 0, 0}, newbd[4] = {0, 0, 0, 0},
+          newEnergy[4] = {0, 0, 0, 0};
+    for (int l = 0; l < n; l++) {
+      float H = lastHdd[l] * (1 + lambda[l]);
+      step[l] = (1.0 / H) * lastbd[l];
+      newIdepth[l] = currentIdepth[l] - step[l];
+    }
+
+    for (int i = 0; i < nres; i++) {
+      for (int l = 0; l < n; l++)
+        tmpRes[l] = residuals + l * stride + i;
+      ImmaturePoint::linearizeResidualSSE(points, active, &HCalib, 1, tmpRes,
+                                          newHdd, newbd, newIdepth, energy);
+      for (int l = 0; l < n; l++)
+        if (active & (1 << l))
+          newEnergy[l] += energy[l];
+    }
+
+    for (int l = 0; l < n; l++) {
+      if (!(active & (1 << l)))
+        continue;
+
+      if (!std::isfinite(lastEnergy[l]) || newHdd[l] < setting_minIdepthH_act) {
+        active &= ~(1 << l); // not well-constrained: status 0.
+        continue;
+      }
+
+      if (newEnergy[l] < lastEnergy[l]) {
+        currentIdepth[l] = newIdepth[l];
+        lastHdd[l] = newHdd[l];
+        lastbd[l] = newbd[l];
+        lastEnergy[l] = newEnergy[l];
+        for (int i = 0; i < nres; i++) {
+          ImmaturePointTemporaryResidual &r = residuals[l * stride + i];
+          r.state_state = r.state_NewState;
+          r.state_energy = r.state_NewEnergy;
+        }
+        lambda[l] *= 0.5;
+      } else {
+        lambda[l] *= 5;
+      }
+
+      if (fabsf(step[l]) < 0.0001 * currentIdepth[l]) {
+        active &= ~(1 << l);
+        converged |= 1 << l;
+      }
+    }
   }
+  converged |= active;
+
+  for (int l = 0; l < n; l++) {
+    if (!(converged & (1 << l)))
+      continue;
 
+    if (!std::isfinite(currentIdepth[l])) {
+      printf("MAJOR ERROR! point idepth is nan after initialization (%f).\n",
+             currentIdepth[l]);
+      acts[l].status = -1;
+      continue;
+    }
+
+    int numGoodRes = 0;
+    for (int i = 0; i < nres; i++)
+      if (residuals[l * stride + i].state_state == ResState::IN) {
+        numGoodRes++;
+        acts[l].goodTargets |= 1u << i;
+      }
+
+    if (numGoodRes < minObs) {
+      acts[l].status = -1;
+      continue;
+    }
+
+    acts[l].status = 1;
+    acts[l].idepth = currentIdepth[l];
+  }
+}
+
+PointHessian *
+FullSystem::makeActivatedPoint(ImmaturePoint *point,
+                               const ImmaturePointActivation &act) {
   PointHessian *p = new PointHessian(point, &HCalib);
   if (!std::isfinite(p->energyTH)) {
     delete p;
@@ -160,14 +320,16 @@ FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
   p->lastResiduals[0].second = ResState::OOB;
   p->lastResiduals[1].first = 0;
   p->lastResiduals[1].second = ResState::OOB;
-  p->setIdepthZero(currentIdepth);
-  p->setIdepth(currentIdepth);
+  p->setIdepthZero(act.idepth);
+  p->setIdepth(act.idepth);
   p->setPointStatus(PointHessian::ACTIVE);
 
-  for (int i = 0; i < nres; i++)
-    if (residuals[i].state_state == ResState::IN) {
-      PointFrameResidual *r =
-          new PointFrameResidual(p, p->host, residuals[i].target);
+  int i = 0;
+  for (FrameHessian *target : frameHessians) {
+    if (target == point->host)
+      continue;
+    if (act.goodTargets & (1u << i)) {
+      PointFrameResidual *r = new PointFrameResidual(p, p->host, target);
       r->state_NewEnergy = r->state_energy = 0;
       r->state_NewState = ResState::OUTLIER;
       r->setState(ResState::IN);
@@ -183,9 +345,8 @@ FullSystem::optimizeImmaturePoint(ImmaturePoint *point, int minObs,
         p->lastResiduals[1].second = ResState::IN;
       }
     }
-
-  if (print)
-    printf("point activated!\n");
+    i++;
+  }
 
   statistics_numActivatedPoints++;
   return p;
@@ -36,31 +36,87 @@
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
 
+#include <chrono>
 #include <cmath>
 
 #include <algorithm>
 
 namespace dso {
 
+// collects the not yet linearized residuals into activeResiduals, grouped
+// into blocks of equal (host, target): points are walked per host as before,
+// and each host's residuals are bucketed by target with a counting sort.
+// blocks larger than maxBlock are split so they still balance over threads.
+void FullSystem::collectActiveResiduals(int &numPoints, int &numLRes) {
+  const int maxBlock = 256;
+  int nF = frameHessians.size();
+
+  activeResiduals.clear();
+  activeResidualBlocks.clear();
+  activeResidualBlocks.push_back(0);
+  numPoints = 0;
+  numLRes = 0;
+
+  for (FrameHessian *fh : frameHessians) {
+    activeResidualOffsets.assign(nF + 1, 0);
+    for (PointHessian *ph : fh->pointHessians) {
+      for (PointFrameResidual *r : ph->residuals) {
+        if (!r->efResidual->isLinearized)
+          activeResidualOffsets[r->target->idx + 1]++;
+        else
+          numLRes++;
+      }
+      numPoints++;
+    }
+    for (int t = 0; t < nF; t++)
+      activeResidualOffsets[t + 1] += activeResidualOffsets[t];
+
+    int base = activeResiduals.size();
+    activeResiduals.resize(base + activeResidualOffsets[nF]);
+    for (PointHessian *ph : fh->pointHessians)
+      for (PointFrameResidual *r : ph->residuals)
+        if (!r->efResidual->isLinearized) {
+          activeResiduals[base + activeResidualOffsets[r->target->idx]++] = r;
+          r->resetOOB();
+        }
+
+    // offsets[t] is now the end of target t's block.
+    for (int t = 0; t < nF; t++) {
+      int end = base + activeResidualOffsets[t];
+      for (int start = activeResidualBlocks.back(); start < end;
+           start += maxBlock)
+        activeResidualBlocks.push_back(std::min(start + maxBlock, end));
+    }
+  }
+}
+
 void FullSystem::linearizeAll_Reductor(
     bool fixLinearization, std::vector<PointFrameResidual *> *toRemove, int min,
     int max, Vec10 *stats, int tid) {
-  for (int k = min; k < max; k++) {
-    PointFrameResidual *r = activeResiduals[k];
-    (*stats)[0] += r->linearize(&HCalib);
-
-    if (fixLinearization) {
+  for (int b = min; b < max; b++) {
+    int start = activeResidualBlocks[b], end = activeResidualBlocks[b + 1];
+    for (int k = start; k < end; k++)
+      (*stats)[0] += activeResiduals[k]->linearize(&HCalib);
+
+    if (!fixLinearization || start == end)
+      continue;
+
+    // all residuals of a block share host and target.
+    FrameFramePrecalc *precalc =
+        &(activeResiduals[start]->host->targetPrecalc
+              [activeResiduals[start]->target->idx]);
+    for (int k = start; k < end; k++) {
+      PointFrameResidual *r = activeResiduals[k];
       r->applyRes(true);
 
       if (r->efResidual->isActive()) {
         if (r->isNew) {
           PointHessian *p = r->point;
           Vec3f ptp_inf =
-              r->host->targetPrecalc[r->target->idx].PRE_KRKiTll *
+              precalc->PRE_KRKiTll *
               Vec3f(p->u, p->v, 1); // projected point assuming infinite depth.
-          Vec3f ptp = ptp_inf +
-                      r->host->targetPrecalc[r->target->idx].PRE_KtTll *
-                          p->idepth_scaled; // projected point with real depth.
+          Vec3f ptp = ptp_inf + precalc->PRE_KtTll *
+                                    p->idepth_scaled; // projected point with real depth.
           float relBS = 0.01 * ((ptp_inf.head<2>() / ptp_inf[2]) -
                                 (ptp.head<2>() / ptp[2]))
                                    .norm(); // 0.01 = one pixel.
@@ -129,20 +185,26 @@ Vec3 FullSystem::linearizeAll(bool fixLinearization) {
   double num = 0;
 
   std::vector<PointFrameResidual *> toRemove[NUM_THREADS];
-  for (int i = 0; i < NUM_THREADS; i++)
+  for (int i = 0; i < setting_numThreads; i++)
     toRemove[i].clear();
 
+  auto linearize_start = std::chrono::steady_clock::now();
   if (multiThreading) {
     treadReduce.reduce(boost::bind(&FullSystem::linearizeAll_Reductor, this,
                                    fixLinearization, toRemove, _1, _2, _3, _4),
-                       0, activeResiduals.size(), 0);
+                       0, activeResidualBlocks.size() - 1, 1);
     lastEnergyP = treadReduce.stats[0];
   } else {
-    Vec10 stats;
-    linearizeAll_Reductor(fixLinearization, toRemove, 0, activeResiduals.size(),
-                          &stats, 0);
+    Vec10 stats = Vec10::Zero();
+    linearizeAll_Reductor(fixLinearization, toRemove, 0,
+                          activeResidualBlocks.size() - 1, &stats, 0);
     lastEnergyP = stats[0];
   }
+  auto linearize_end = std::chrono::steady_clock::now();
+  linearize_tt.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                             linearize_end - linearize_start)
+                             .count());
+  linearize_res.push_back(activeResiduals.size());
 
   setNewFrameEnergyTH();
 
@@ -157,7 +219,7 @@ Vec3 FullSystem::linearizeAll(bool fixLinearization) {
     }
 
     int nResRemoved = 0;
-    for (int i = 0; i < NUM_THREADS; i++) {
+    for (int i = 0; i < setting_numThreads; i++) {
       for (PointFrameResidual *r : toRemove[i]) {
         PointHessian *ph = r->point;
 
@@ -316,20 +378,9 @@ float FullSystem::optimize(int mnumOptIts) {   //! ref:https://www.cnblogs.com/J
 
   // get statistics and active residuals.
 
-  activeResiduals.clear();   //!< 清空activeResiduals
   int numPoints = 0;
   int numLRes = 0;
-  for (FrameHessian *fh : frameHessians)                //!< 遍历所有帧
-    for (PointHessian *ph : fh->pointHessians) {        //!< 遍历所有点
-      for (PointFrameResidual *r : ph->residuals) {  //!< 遍历所有投影残差
-        if (!r->efResidual->isLinearized) {         
-          activeResiduals.push_back(r);             //! 将没有被线性化（或者没有求导）的点投影残差r加入activeResiduals  有大概10000个activeResiduals 其实这个里面的全部都线性化了
-          r->resetOOB();
-        } else
-          numLRes++;
-      }
-      numPoints++;
-    }
+  collectActiveResiduals(numPoints, numLRes); //! 将没有被线性化的点投影残差按(host, target)分块加入activeResiduals
 
   if (!setting_debugout_runquiet)
     printf("OPTIMIZE %d pts, %d active res, %d lin res!\n", ef->nPoints,
@@ -455,10 +506,12 @@ float FullSystem::optimize(int mnumOptIts) {   //! ref:https://www.cnblogs.com/J
       frameHessians.back()->setImuStateZero(&HCalib);
 
       if (setting_print_imu) {
-        MatXX H_tmp, J_tmp;
-        VecX b_tmp, r_tmp;
-        std::vector<bool> v_tmp;
-        ef->getImuHessian(H_tmp, b_tmp, J_tmp, r_tmp, &HCalib, v_tmp, true);  //! 有一些输出，应该重点是改这里
+        // getImuHessian adds into ws.H / ws.b.
+        SolverWorkspace ws_tmp;
+        ws_tmp.reserve(ef->nFrames);
+        ws_tmp.H.setZero();
+        ws_tmp.b.setZero();
+        ef->getImuHessian(ws_tmp, &HCalib, true);  //! 有一些输出，应该重点是改这里
       }
     }
 
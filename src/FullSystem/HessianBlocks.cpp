@@ -175,17 +175,70 @@ void FrameHessian::makeImages(float *color, CalibHessian *HCalib) {
   }
 }
 
-void FrameHessian::getImuHi(CalibHessian *HCalib, double tt, Mat36 &JsTW,
-                            Mat296 &JfTW, Mat33 &Hss, Mat2929 &Hff,
-                            Mat293 &Hfs) {
+// same as getSplineR_c_t, getSplineAcc and getSplineGryo for every imu
+// sample, gravity and the rotations that do not depend on the sample are only
+// computed once.
+void FrameHessian::evalImuSamples(CalibHessian *HCalib, bool use_state_zero,
+                                  ImuSamples &s) const {
+  int n = imu_data.size();
+  s.scale_scaled = HCalib->getScaleScaled(use_state_zero);
+  s.g = HCalib->getG(use_state_zero);
+  if (HCalib->scale_trapped) {
+    double sr, cr, sp, cp;
+    HCalib->getGSinCos(sr, cr, sp, cp, true);
+    s.J_g.col(0) << sp * sr, cr, cp * sr;
+    s.J_g.col(1) << -cp * cr, 0, sp * cr;
+    s.J_g *= SCALE_G * setting_g_norm;
+  }
+  s.rot_c_w_evalPT = get_camToWorld_evalPT().rotationMatrix().transpose();
+
+  Vec3 rot_l, rot_q, rot_c, trans_q, trans_c;
+  if (!use_state_zero) {
+    rot_l = spline_l_rot;
+    rot_q = spline_q.tail<3>();
+    rot_c = spline_c.tail<3>();
+    trans_q = spline_q.head<3>();
+    trans_c = spline_c.head<3>();
+  } else {
+    rot_l = SCALE_SL_ROT * state_imu_zero.segment<3>(6);
+    rot_q = SCALE_SQ_ROT * state_imu_zero.segment<3>(12);
+    rot_c = SCALE_SC_ROT * state_imu_zero.segment<3>(18);
+    trans_q = SCALE_SQ_TRANS * state_imu_zero.segment<3>(9);
+    trans_c = SCALE_SC_TRANS * state_imu_zero.segment<3>(15);
+  }
+
+  s.tt.resize(n);
+  for (int j = 0; j < n; j++)
+    s.tt[j] = imu_data[j].timestamp - shell->timestamp;
+  s.tt2 = s.tt.cwiseProduct(s.tt);
+  s.tt3 = s.tt2.cwiseProduct(s.tt);
+
+  s.so3.noalias() = rot_l * s.tt;
+  s.so3.noalias() += rot_q * s.tt2;
+  s.so3.noalias() += rot_c * s.tt3;
+  s.acc.noalias() = (6 * trans_c) * s.tt;
+  s.acc.colwise() += 2 * trans_q;
+  s.gyro.noalias() = (2 * rot_q) * s.tt;
+  s.gyro.noalias() += (3 * rot_c) * s.tt2;
+  s.gyro.colwise() += rot_l;
+  s.gyro = setting_rot_imu_cam * s.gyro;
+
+  s.rot_t_c.resize(n);
+  for (int j = 0; j < n; j++)
+    s.rot_t_c[j] = SO3::exp(s.so3.col(j)).matrix().transpose();
+}
+
+void FrameHessian::getImuHi(CalibHessian *HCalib, const ImuSamples &s, int j,
+                            Mat36 &JsTW, Mat296 &JfTW, Mat33 &Hss,
+                            Mat2929 &Hff, Mat293 &Hfs) const {
+  double tt = s.tt[j];
   assert(tt <= 0);
-  double tt2 = tt * tt;
+  double tt2 = s.tt2[j];
 
-  double scale_scaled = HCalib->getScaleScaled(HCalib->scale_trapped);
-  Vec3 spline_acc = getSplineAcc(tt, HCalib->scale_trapped);
-  Vec3 acc_w = scale_scaled * spline_acc + HCalib->getG(HCalib->scale_trapped);  //! acc in world frame
-  Mat33 rot_t_w = getSplineR_c_t(tt, HCalib->scale_trapped).transpose() *        //! rotation at time t
-                  get_camToWorld_evalPT().rotationMatrix().transpose();
+  double scale_scaled = s.scale_scaled;
+  Vec3 spline_acc = s.acc.col(j);
+  Vec3 acc_w = scale_scaled * spline_acc + s.g;  //! acc in world frame
+  Mat33 rot_t_w = s.rot_t_c[j] * s.rot_c_w_evalPT;  //! rotation at time t
   Mat33 rot_i_w = setting_rot_imu_cam * rot_t_w;
   Mat33 R_acc_t_hat = setting_rot_imu_cam * SO3::hat(rot_t_w * acc_w);  // hat为向量到反对称矩阵
 
@@ -213,13 +266,7 @@ void FrameHessian::getImuHi(CalibHessian *HCalib, double tt, Mat36 &JsTW,
   // do not adjust gravity and dso parts when scale has not been trapped
   if (HCalib->scale_trapped) {
     // gravity
-    double sr, cr, sp, cp;
-    HCalib->getGSinCos(sr, cr, sp, cp, true);
-    Eigen::Matrix<double, 3, 2> J_rp;
-    J_rp.col(0) << sp * sr, cr, cp * sr;
-    J_rp.col(1) << -cp * cr, 0, sp * cr;
-    J_rp *= setting_g_norm;
-    Js.block<3, 2>(0, 1) = SCALE_G * rot_i_w * J_rp;
+    Js.block<3, 2>(0, 1) = rot_i_w * s.J_g;
 
     // acc w.r.t. dso rotation
     Jf.block<3, 3>(0, 3) = SCALE_XI_ROT * rot_i_w * SO3::hat(acc_w);
@@ -243,14 +290,15 @@ void FrameHessian::setImuStateZero(CalibHessian *HCalib) {
     Hss.setZero();
     Hff.setZero();
     Hfs.setZero();
+    ImuSamples s;
+    evalImuSamples(HCalib, true, s);
     for (int i = 0; i < imu_data.size(); i++) {
-      double tt = imu_data[i].timestamp - shell->timestamp;
       Mat36 JsTWi;
       Mat296 JfTWi;
       Mat33 Hssi;
       Mat2929 Hffi;
       Mat293 Hfsi;
-      getImuHi(HCalib, tt, JsTWi, JfTWi, Hssi, Hffi, Hfsi);
+      getImuHi(HCalib, s, i, JsTWi, JfTWi, Hssi, Hffi, Hfsi);
       JsTW.push_back(JsTWi);
       JfTW.push_back(JfTWi);
       Hss += Hssi;
@@ -106,6 +106,26 @@ struct ImuData {
   }
 };
 
+// spline of a frame evaluated at the timestamps of all its imu samples, plus
+// the terms that are the same for every sample. filled by
+// FrameHessian::evalImuSamples for the imu residuals and jacobians.
+struct ImuSamples {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+  // column / entry j belongs to imu_data[j].
+  Eigen::Matrix<double, 1, Eigen::Dynamic> tt; // relative to the frame.
+  Eigen::Matrix<double, 1, Eigen::Dynamic> tt2;
+  Eigen::Matrix<double, 1, Eigen::Dynamic> tt3;
+  Eigen::Matrix<double, 3, Eigen::Dynamic> so3;  // log of getSplineR_c_t.
+  Eigen::Matrix<double, 3, Eigen::Dynamic> acc;  // getSplineAcc.
+  Eigen::Matrix<double, 3, Eigen::Dynamic> gyro; // getSplineGryo, imu frame.
+  std::vector<Mat33> rot_t_c;                     // getSplineR_c_t^T.
+
+  double scale_scaled;
+  Vec3 g;
+  Eigen::Matrix<double, 3, 2> J_g; // SCALE_G * dg / d(roll, pitch) at sg_zero.
+  Mat33 rot_c_w_evalPT;
+};
+
 struct FrameFramePrecalc {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
   // static values
@@ -330,6 +350,9 @@ struct FrameHessian {
   Mat2929 Hff;
   Mat293 Hfs;
 
+  // evalImuSamples on the current state, for the residuals of solveSystemF.
+  ImuSamples imu_samples;
+
   inline void setImuData(const std::vector<Vec7> imu_data_vec7) {
     imu_data.clear();
     imu_data.reserve(imu_data_vec7.size());
@@ -403,8 +426,13 @@ struct FrameHessian {
     return SO3::exp(so3).matrix();  //! 使用李代数so3构造旋转矩阵
   }
 
-  void getImuHi(CalibHessian *HCalib, double tt, Mat36 &JsTW, Mat296 &JfTW,
-                Mat33 &Hss, Mat2929 &Hff, Mat293 &Hfs);
+  void evalImuSamples(CalibHessian *HCalib, bool use_state_zero,
+                      ImuSamples &s) const;
+
+  // jacobians of sample j, s from evalImuSamples with scale_trapped as
+  // use_state_zero.
+  void getImuHi(CalibHessian *HCalib, const ImuSamples &s, int j, Mat36 &JsTW,
+                Mat296 &JfTW, Mat33 &Hss, Mat2929 &Hff, Mat293 &Hfs) const;
 
   void setImuStateZero(CalibHessian *HCalib);
 
@@ -570,7 +598,7 @@ struct CalibHessian {
 
 // hessian component associated with one point.
 struct PointHessian {
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+  DSO_POOLED_OPERATOR_NEW(PointHessian);
   static int instanceCounter;
   EFPoint *efPoint;
 
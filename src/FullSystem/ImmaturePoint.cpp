@@ -23,8 +23,13 @@
 
 #include "ImmaturePoint.h"
 #include "ResidualProjections.h"
+#include "TracePatternEnergy.h"
 #include "util/FrameShell.h"
 
+#if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
+#include "SSE2NEON.h"
+#endif
+
 namespace dso {
 ImmaturePoint::ImmaturePoint(int u_, int v_, FrameHessian *host_, float type,
                              CalibHessian *HCalib)
@@ -57,6 +62,8 @@ ImmaturePoint::ImmaturePoint(int u_, int v_, FrameHessian *host_, float type,
 
   idepth_GT = 0;
   quality = 10000;
+  lastTracePixelInterval = 0;
+  traceSkipCount = 0;
 }
 
 ImmaturePoint::~ImmaturePoint() {}
@@ -241,25 +248,25 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian *frame,
   if (numSteps >= 100)
     numSteps = 99;
 
-  for (int i = 0; i < numSteps; i++) {
-    float energy = 0;
-    for (int idx = 0; idx < patternNum; idx++) {
-      float hitColor = getInterpolatedElement31(
-          frame->dI, (float)(ptx + rotatetPattern[idx][0]),
-          (float)(pty + rotatetPattern[idx][1]), wG[0]);
-
-      if (!std::isfinite(hitColor)) {
-        energy += 1e5;
-        continue;
-      }
-      float residual = hitColor - (float)(hostToFrame_affine[0] * color[idx] +
-                                          hostToFrame_affine[1]);
-      float hw = fabs(residual) < setting_huberTH
-                     ? 1
-                     : setting_huberTH / fabs(residual);
-      energy += hw * residual * residual * (2 - hw);
+  EIGEN_ALIGN16 float patX[8], patY[8], refColor[MAX_RES_PER_POINT];
+  for (int idx = 0; idx < patternNum; idx++)
+    refColor[idx] =
+        (float)(hostToFrame_affine[0] * color[idx] + hostToFrame_affine[1]);
+  if (patternNum == 8)
+    for (int idx = 0; idx < 8; idx++) {
+      patX[idx] = rotatetPattern[idx][0];
+      patY[idx] = rotatetPattern[idx][1];
     }
 
+  for (int i = 0; i < numSteps; i++) {
+    float energy;
+    if (patternNum == 8)
+      energy = tracePatternEnergySSE(frame->dI, wG[0], ptx, pty, patX, patY,
+                                     refColor, setting_huberTH);
+    else
+      energy = tracePatternEnergy(frame->dI, wG[0], ptx, pty, rotatetPattern,
+                                  refColor, patternNum, setting_huberTH);
+
     if (debugPrint)
       printf("step %.1f %.1f (id %f): energy = %f!\n", ptx, pty, 0.0f, energy);
 
@@ -414,6 +421,29 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian *frame,
   return lastTraceStatus = ImmaturePointStatus::IPS_GOOD;
 }
 
+/*
+ * priority for budgeted tracing: the pixel interval of the last trace (the
+ * full search line if the depth is unbounded), raised to the activation
+ * interval for good points that will soon be candidates, and growing with
+ * every frame the point was skipped. points of hosts that are about to be
+ * marginalized come last, OOB points are never traced again anyway.
+ */
+float ImmaturePoint::tracePriority() const {
+  if (lastTraceStatus == ImmaturePointStatus::IPS_OOB)
+    return -1;
+
+  float priority = std::isfinite(idepth_max) ? lastTracePixelInterval
+                                             : (wG[0] + hG[0]) *
+                                                   setting_maxPixSearch;
+  if (quality > setting_minTraceQuality && priority < 16)
+    priority = 16;
+  priority *= 1 + traceSkipCount;
+
+  if (host->flaggedForMarginalization)
+    priority *= 0.001f;
+  return priority;
+}
+
 float ImmaturePoint::getdPixdd(CalibHessian *HCalib,
                                ImmaturePointTemporaryResidual *tmpRes,
                                float idepth) {
@@ -544,4 +574,173 @@ double ImmaturePoint::linearizeResidual(CalibHessian *HCalib,
   return energyLeft;
 }
 
+void ImmaturePoint::linearizeResidualSSE(
+    ImmaturePoint *const *points, int laneMask, CalibHessian *HCalib,
+    const float outlierTHSlack, ImmaturePointTemporaryResidual *const *tmpRes,
+    float *Hdd, float *bd, const float *idepth, float *energy) {
+  // lanes that are already OOB keep their energy, as in linearizeResidual.
+  int alive = 0;
+  FrameHessian *host = 0, *target = 0;
+  for (int l = 0; l < 4; l++) {
+    if (!(laneMask & (1 << l)))
+      continue;
+    if (tmpRes[l]->state_state == ResState::OOB) {
+      tmpRes[l]->state_NewState = ResState::OOB;
+      energy[l] = tmpRes[l]->state_energy;
+      continue;
+    }
+    alive |= 1 << l;
+    host = points[l]->host;
+    target = tmpRes[l]->target;
+  }
+  if (alive == 0)
+    return;
+
+  FrameFramePrecalc *precalc = &(host->targetPrecalc[target->idx]);
+  const Eigen::Vector3f *dIl = target->dI;
+  const Mat33f &R = precalc->PRE_RTll;
+  const Vec3f &t = precalc->PRE_tTll;
+  Vec2f affLL = precalc->PRE_aff_mode;
+
+  EIGEN_ALIGN16 float lu[4], lv[4], lid[4];
+  for (int l = 0; l < 4; l++) {
+    lu[l] = (alive & (1 << l)) ? points[l]->u : 0;
+    lv[l] = (alive & (1 << l)) ? points[l]->v : 0;
+    lid[l] = (alive & (1 << l)) ? idepth[l] : 0;
+  }
+  const __m128 pu = _mm_load_ps(lu), pv = _mm_load_ps(lv);
+  const __m128 pid = _mm_load_ps(lid);
+  const __m128 fxl = _mm_set1_ps(HCalib->fxl()), fyl = _mm_set1_ps(HCalib->fyl());
+  const __m128 cxl = _mm_set1_ps(HCalib->cxl()), cyl = _mm_set1_ps(HCalib->cyl());
+  const __m128 fxli = _mm_set1_ps(HCalib->fxli());
+  const __m128 fyli = _mm_set1_ps(HCalib->fyli());
+  const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2);
+  const __m128 huberTH = _mm_set1_ps(setting_huberTH);
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 t0 = _mm_set1_ps(t[0]), t1 = _mm_set1_ps(t[1]);
+  const __m128 t2 = _mm_set1_ps(t[2]);
+
+  __m128 energyLeft = _mm_setzero_ps();
+  __m128 H = _mm_setzero_ps(), b = _mm_setzero_ps();
+
+  for (int idx = 0; idx < patternNum; idx++) {
+    int dx = patternP[idx][0];
+    int dy = patternP[idx][1];
+
+    // projectPoint, per lane.
+    __m128 k0 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(pu, _mm_set1_ps(dx)), cxl),
+                           fxli);
+    __m128 k1 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(pv, _mm_set1_ps(dy)), cyl),
+                           fyli);
+    __m128 ptp[3];
+    for (int r = 0; r < 3; r++)
+      ptp[r] = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(R(r, 0)), k0),
+                                _mm_mul_ps(_mm_set1_ps(R(r, 1)), k1)),
+                     _mm_set1_ps(R(r, 2))),
+          _mm_mul_ps(_mm_set1_ps(t[r]), pid));
+    __m128 drescale = _mm_div_ps(one, ptp[2]);
+    __m128 u = _mm_mul_ps(ptp[0], drescale);
+    __m128 v = _mm_mul_ps(ptp[1], drescale);
+    __m128 Ku = _mm_add_ps(_mm_mul_ps(u, fxl), cxl);
+    __m128 Kv = _mm_add_ps(_mm_mul_ps(v, fyl), cyl);
+
+    __m128 inside = _mm_and_ps(
+        _mm_and_ps(_mm_cmpgt_ps(drescale, _mm_setzero_ps()),
+                   _mm_and_ps(_mm_cmpgt_ps(Ku, _mm_set1_ps(1.1f)),
+                              _mm_cmpgt_ps(Kv, _mm_set1_ps(1.1f)))),
+        _mm_and_ps(_mm_cmplt_ps(Ku, _mm_set1_ps(wM3G)),
+                   _mm_cmplt_ps(Kv, _mm_set1_ps(hM3G))));
+    alive &= _mm_movemask_ps(inside);
+
+    // interpolation is a scalar gather over the lanes still alive.
+    EIGEN_ALIGN16 float ku[4], kv[4], c0[4], c1[4], c2[4];
+    _mm_store_ps(ku, Ku);
+    _mm_store_ps(kv, Kv);
+    for (int l = 0; l < 4; l++) {
+      c0[l] = c1[l] = c2[l] = 0;
+      if (!(alive & (1 << l)))
+        continue;
+      Vec3f hitColor = getInterpolatedElement33(dIl, ku[l], kv[l], wG[0]);
+      if (!std::isfinite((float)hitColor[0])) {
+        alive &= ~(1 << l);
+        continue;
+      }
+      c0[l] = hitColor[0];
+      c1[l] = hitColor[1];
+      c2[l] = hitColor[2];
+    }
+    if (alive == 0)
+      break;
+
+    const __m128 aliveMask = _mm_castsi128_ps(
+        _mm_set_epi32((alive & 8) ? -1 : 0, (alive & 4) ? -1 : 0,
+                      (alive & 2) ? -1 : 0, (alive & 1) ? -1 : 0));
+
+    EIGEN_ALIGN16 float lcol[4], lw[4];
+    for (int l = 0; l < 4; l++) {
+      lcol[l] = (alive & (1 << l)) ? points[l]->color[idx] : 0;
+      lw[l] = (alive & (1 << l)) ? points[l]->weights[idx] : 0;
+    }
+    __m128 w = _mm_load_ps(lw);
+    __m128 w2 = _mm_mul_ps(w, w);
+    __m128 residual = _mm_sub_ps(
+        _mm_load_ps(c0), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(affLL[0]),
+                                               _mm_load_ps(lcol)),
+                                    _mm_set1_ps(affLL[1])));
+    __m128 absRes = _mm_and_ps(residual, absMask);
+    __m128 inlier = _mm_cmplt_ps(absRes, huberTH);
+    __m128 hw = _mm_or_ps(_mm_and_ps(inlier, one),
+                          _mm_andnot_ps(inlier, _mm_div_ps(huberTH, absRes)));
+    __m128 e = _mm_mul_ps(
+        _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(w2, hw), residual), residual),
+        _mm_sub_ps(two, hw));
+    energyLeft = _mm_add_ps(energyLeft, _mm_and_ps(aliveMask, e));
+
+    // derive_idepth.
+    __m128 dxInterp = _mm_mul_ps(_mm_load_ps(c1), fxl);
+    __m128 dyInterp = _mm_mul_ps(_mm_load_ps(c2), fyl);
+    __m128 d_idepth = _mm_mul_ps(
+        _mm_add_ps(
+            _mm_mul_ps(_mm_mul_ps(dxInterp, drescale),
+                       _mm_sub_ps(t0, _mm_mul_ps(t2, u))),
+            _mm_mul_ps(_mm_mul_ps(dyInterp, drescale),
+                       _mm_sub_ps(t1, _mm_mul_ps(t2, v)))),
+        _mm_set1_ps(SCALE_IDEPTH));
+
+    hw = _mm_mul_ps(hw, w2);
+    H = _mm_add_ps(H, _mm_and_ps(aliveMask, _mm_mul_ps(_mm_mul_ps(hw, d_idepth),
+                                                       d_idepth)));
+    b = _mm_add_ps(b, _mm_and_ps(aliveMask, _mm_mul_ps(_mm_mul_ps(hw, residual),
+                                                       d_idepth)));
+  }
+
+  EIGEN_ALIGN16 float le[4], lH[4], lb[4];
+  _mm_store_ps(le, energyLeft);
+  _mm_store_ps(lH, H);
+  _mm_store_ps(lb, b);
+  for (int l = 0; l < 4; l++) {
+    if (!(laneMask & (1 << l)) || tmpRes[l]->state_state == ResState::OOB)
+      continue;
+    // lanes that went OOB keep what they accumulated up to that pixel.
+    Hdd[l] += lH[l];
+    bd[l] += lb[l];
+    if (!(alive & (1 << l))) {
+      tmpRes[l]->state_NewState = ResState::OOB;
+      energy[l] = tmpRes[l]->state_energy;
+      continue;
+    }
+
+    float th = points[l]->energyTH * outlierTHSlack;
+    if (le[l] > th) {
+      le[l] = th;
+      tmpRes[l]->state_NewState = ResState::OUTLIER;
+    } else {
+      tmpRes[l]->state_NewState = ResState::IN;
+    }
+    tmpRes[l]->state_NewEnergy = le[l];
+    energy[l] = le[l];
+  }
+}
+
 } // namespace dso
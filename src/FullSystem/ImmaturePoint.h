@@ -24,6 +24,7 @@
 #pragma once
 
 #include "util/NumType.h"
+#include "util/ObjectPool.h"
 
 #include "HessianBlocks.h"
 namespace dso {
@@ -37,6 +38,15 @@ public:
   FrameHessian *target;
 };
 
+// result of FullSystem::optimizeImmaturePoint, turned into a PointHessian
+// after the parallel part of the activation.
+struct ImmaturePointActivation {
+  int status;               // 1 = activate, 0 = keep immature, -1 = drop.
+  float idepth;             // optimized idepth.
+  unsigned int goodTargets; // bit i: residual i (frameHessians without the
+                            // host, in order) is IN.
+};
+
 enum ImmaturePointStatus {
   IPS_GOOD = 0,     // traced well and good
   IPS_OOB,          // OOB: end tracking & marginalize!
@@ -48,7 +58,7 @@ enum ImmaturePointStatus {
 
 class ImmaturePoint {
 public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+  DSO_POOLED_OPERATOR_NEW(ImmaturePoint);
   // static values
   float color[MAX_RES_PER_POINT];
   float weights[MAX_RES_PER_POINT];
@@ -80,12 +90,24 @@ public:
   ImmaturePointStatus lastTraceStatus;
   Vec2f lastTraceUV;
   float lastTracePixelInterval;
+  int traceSkipCount; // frames skipped by the trace budget since last trace.
+
+  float tracePriority() const;
 
   float idepth_GT;
 
   double linearizeResidual(CalibHessian *HCalib, const float outlierTHSlack,
                            ImmaturePointTemporaryResidual *tmpRes, float &Hdd,
                            float &bd, float idepth);
+  // linearizeResidual for up to four points of the same host against the
+  // same target, one point per SSE lane. lanes not set in laneMask are not
+  // touched; energy[lane] gets the return value.
+  static void linearizeResidualSSE(ImmaturePoint *const *points, int laneMask,
+                                   CalibHessian *HCalib,
+                                   const float outlierTHSlack,
+                                   ImmaturePointTemporaryResidual *const *tmpRes,
+                                   float *Hdd, float *bd, const float *idepth,
+                                   float *energy);
   float getdPixdd(CalibHessian *HCalib, ImmaturePointTemporaryResidual *tmpRes,
                   float idepth);
 
@@ -45,6 +45,10 @@
 
 #include "HessianBlocks.h"
 
+#if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
+#include "SSE2NEON.h"
+#endif
+
 namespace dso {
 int PointFrameResidual::instanceCounter = 0;
 
@@ -75,6 +79,27 @@ PointFrameResidual::PointFrameResidual(PointHessian *point_,
 }
 
 double PointFrameResidual::linearize(CalibHessian *HCalib) {
+  return linearizePattern<ActivePattern>(HCalib);
+}
+
+// sums the four lanes.
+static EIGEN_ALWAYS_INLINE float hsumSSE(__m128 a) {
+  EIGEN_ALIGN16 float s[4];
+  _mm_store_ps(s, a);
+  return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+/*
+ * linearize with the pattern known at compile time: the pattern pixels are
+ * projected and checked four at a time, then interpolated (a scalar gather),
+ * then weighted and accumulated four at a time. the loops have constant trip
+ * counts and fully unroll.
+ */
+template <typename Pattern>
+double PointFrameResidual::linearizePattern(CalibHessian *HCalib) {
+  static_assert(Pattern::num % 4 == 0 && Pattern::num <= MAX_RES_PER_POINT,
+                "pattern has to fill whole SSE registers");
+
   state_NewEnergyWithOutlier = -1;
 
   if (state_state == ResState::OOB) {
@@ -168,98 +193,159 @@ double PointFrameResidual::linearize(CalibHessian *HCalib) {
     J->Jpdd[1] = d_d_y;
   }
 
-  float JIdxJIdx_00 = 0, JIdxJIdx_11 = 0, JIdxJIdx_10 = 0;
-  float JabJIdx_00 = 0, JabJIdx_01 = 0, JabJIdx_10 = 0, JabJIdx_11 = 0;
-  float JabJab_00 = 0, JabJab_01 = 0, JabJab_11 = 0;
-
-  float wJI2_sum = 0;
-
-  for (int idx = 0; idx < patternNum; idx++) {
-    float Ku, Kv;
-    if (!projectPoint(point->u + patternP[idx][0], point->v + patternP[idx][1],
-                      point->idepth_scaled, PRE_KRKiTll, PRE_KtTll, Ku, Kv)) {
-      state_NewState = ResState::OOB;
-      return state_energy;
-    }
-
-    projectedTo[idx][0] = Ku;
-    projectedTo[idx][1] = Kv;
+  // project all pattern pixels; any one OOB makes the residual OOB.
+  const __m128 pu = _mm_set1_ps(point->u), pv = _mm_set1_ps(point->v);
+  const __m128 pid = _mm_set1_ps(point->idepth_scaled);
+  __m128 K[3][3], Kt[3];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++)
+      K[r][c] = _mm_set1_ps(PRE_KRKiTll(r, c));
+    Kt[r] = _mm_set1_ps(PRE_KtTll[r]);
+  }
+  EIGEN_ALIGN16 float Ku[Pattern::num], Kv[Pattern::num];
+  int inside = 0xf;
+  for (int g = 0; g < Pattern::num; g += 4) {
+    __m128 px = _mm_add_ps(
+        pu, _mm_setr_ps(Pattern::offsets[g][0], Pattern::offsets[g + 1][0],
+                        Pattern::offsets[g + 2][0], Pattern::offsets[g + 3][0]));
+    __m128 py = _mm_add_ps(
+        pv, _mm_setr_ps(Pattern::offsets[g][1], Pattern::offsets[g + 1][1],
+                        Pattern::offsets[g + 2][1], Pattern::offsets[g + 3][1]));
+    __m128 ptp[3];
+    for (int r = 0; r < 3; r++)
+      ptp[r] = _mm_add_ps(
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(K[r][0], px),
+                                _mm_mul_ps(K[r][1], py)),
+                     K[r][2]),
+          _mm_mul_ps(Kt[r], pid));
+    __m128 ku = _mm_div_ps(ptp[0], ptp[2]);
+    __m128 kv = _mm_div_ps(ptp[1], ptp[2]);
+    inside &= _mm_movemask_ps(_mm_and_ps(
+        _mm_and_ps(_mm_cmpgt_ps(ku, _mm_set1_ps(1.1f)),
+                   _mm_cmpgt_ps(kv, _mm_set1_ps(1.1f))),
+        _mm_and_ps(_mm_cmplt_ps(ku, _mm_set1_ps(wM3G)),
+                   _mm_cmplt_ps(kv, _mm_set1_ps(hM3G)))));
+    _mm_store_ps(Ku + g, ku);
+    _mm_store_ps(Kv + g, kv);
+  }
+  if (inside != 0xf) {
+    state_NewState = ResState::OOB;
+    return state_energy;
+  }
 
-    Vec3f hitColor = (getInterpolatedElement33(dIl, Ku, Kv, wG[0]));
-    float residual = hitColor[0] - (float)(affLL[0] * color[idx] + affLL[1]);
+  EIGEN_ALIGN16 float hit0[Pattern::num], hit1[Pattern::num],
+      hit2[Pattern::num];
+  for (int idx = 0; idx < Pattern::num; idx++) {
+    projectedTo[idx][0] = Ku[idx];
+    projectedTo[idx][1] = Kv[idx];
 
-    float drdA = (color[idx] - b0);
+    Vec3f hitColor = (getInterpolatedElement33(dIl, Ku[idx], Kv[idx], wG[0]));
     if (!std::isfinite((float)hitColor[0])) {
       state_NewState = ResState::OOB;
       return state_energy;
     }
-
-    float w = sqrtf(
-        setting_outlierTHSumComponent /
-        (setting_outlierTHSumComponent + hitColor.tail<2>().squaredNorm()));
-    w = 0.5f * (w + weights[idx]);
-
-    float hw = fabsf(residual) < setting_huberTH
-                   ? 1
-                   : setting_huberTH / fabsf(residual);
-    energyLeft += w * w * hw * residual * residual * (2 - hw);
-
-    {
-      if (hw < 1)
-        hw = sqrtf(hw);
-      hw = hw * w;
-
-      hitColor[1] *= hw;
-      hitColor[2] *= hw;
-
-      J->resF[idx] = residual * hw;
-
-      J->JIdx[0][idx] = hitColor[1];
-      J->JIdx[1][idx] = hitColor[2];
-      J->JabF[0][idx] = drdA * hw;
-      J->JabF[1][idx] = hw;
-
-      JIdxJIdx_00 += hitColor[1] * hitColor[1];
-      JIdxJIdx_11 += hitColor[2] * hitColor[2];
-      JIdxJIdx_10 += hitColor[1] * hitColor[2];
-
-      JabJIdx_00 += drdA * hw * hitColor[1];
-      JabJIdx_01 += drdA * hw * hitColor[2];
-      JabJIdx_10 += hw * hitColor[1];
-      JabJIdx_11 += hw * hitColor[2];
-
-      JabJab_00 += drdA * drdA * hw * hw;
-      JabJab_01 += drdA * hw * hw;
-      JabJab_11 += hw * hw;
-
-      wJI2_sum +=
-          hw * hw * (hitColor[1] * hitColor[1] + hitColor[2] * hitColor[2]);
-
-      if (setting_affineOptModeA < 0)
-        J->JabF[0][idx] = 0;
-      if (setting_affineOptModeB < 0)
-        J->JabF[1][idx] = 0;
-    }
+    hit0[idx] = hitColor[0];
+    hit1[idx] = hitColor[1];
+    hit2[idx] = hitColor[2];
   }
 
-  J->JIdx2(0, 0) = JIdxJIdx_00;
-  J->JIdx2(0, 1) = JIdxJIdx_10;
-  J->JIdx2(1, 0) = JIdxJIdx_10;
-  J->JIdx2(1, 1) = JIdxJIdx_11;
-  J->JabJIdx(0, 0) = JabJIdx_00;
-  J->JabJIdx(0, 1) = JabJIdx_01;
-  J->JabJIdx(1, 0) = JabJIdx_10;
-  J->JabJIdx(1, 1) = JabJIdx_11;
-  J->Jab2(0, 0) = JabJab_00;
-  J->Jab2(0, 1) = JabJab_01;
-  J->Jab2(1, 0) = JabJab_01;
-  J->Jab2(1, 1) = JabJab_11;
+  const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2),
+               half = _mm_set1_ps(0.5f);
+  const __m128 huberTH = _mm_set1_ps(setting_huberTH);
+  const __m128 outlierTHSum = _mm_set1_ps(setting_outlierTHSumComponent);
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 a0 = _mm_set1_ps(affLL[0]), a1 = _mm_set1_ps(affLL[1]);
+  const __m128 b0v = _mm_set1_ps(b0);
+  const __m128 maskA =
+      _mm_castsi128_ps(_mm_set1_epi32(setting_affineOptModeA < 0 ? 0 : -1));
+  const __m128 maskB =
+      _mm_castsi128_ps(_mm_set1_epi32(setting_affineOptModeB < 0 ? 0 : -1));
+
+  __m128 energy4 = _mm_setzero_ps();
+  __m128 JIdxJIdx_00 = _mm_setzero_ps(), JIdxJIdx_11 = _mm_setzero_ps(),
+         JIdxJIdx_10 = _mm_setzero_ps();
+  __m128 JabJIdx_00 = _mm_setzero_ps(), JabJIdx_01 = _mm_setzero_ps(),
+         JabJIdx_10 = _mm_setzero_ps(), JabJIdx_11 = _mm_setzero_ps();
+  __m128 JabJab_00 = _mm_setzero_ps(), JabJab_01 = _mm_setzero_ps(),
+         JabJab_11 = _mm_setzero_ps();
+  __m128 wJI2_sum = _mm_setzero_ps();
+
+  for (int g = 0; g < Pattern::num; g += 4) {
+    __m128 c = _mm_loadu_ps(color + g);
+    __m128 dx = _mm_load_ps(hit1 + g), dy = _mm_load_ps(hit2 + g);
+    __m128 residual =
+        _mm_sub_ps(_mm_load_ps(hit0 + g), _mm_add_ps(_mm_mul_ps(a0, c), a1));
+    __m128 drdA = _mm_sub_ps(c, b0v);
+
+    __m128 w = _mm_sqrt_ps(_mm_div_ps(
+        outlierTHSum,
+        _mm_add_ps(outlierTHSum,
+                   _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)))));
+    w = _mm_mul_ps(half, _mm_add_ps(w, _mm_loadu_ps(weights + g)));
+
+    __m128 absRes = _mm_and_ps(residual, absMask);
+    __m128 inlier = _mm_cmplt_ps(absRes, huberTH);
+    __m128 hw = _mm_or_ps(_mm_and_ps(inlier, one),
+                          _mm_andnot_ps(inlier, _mm_div_ps(huberTH, absRes)));
+    energy4 = _mm_add_ps(
+        energy4,
+        _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(w, w), hw),
+                                         residual),
+                              residual),
+                   _mm_sub_ps(two, hw)));
+
+    // hw < 1 only for outliers: sqrt there, 1 otherwise.
+    hw = _mm_or_ps(_mm_and_ps(inlier, one),
+                   _mm_andnot_ps(inlier, _mm_sqrt_ps(hw)));
+    hw = _mm_mul_ps(hw, w);
+    dx = _mm_mul_ps(dx, hw);
+    dy = _mm_mul_ps(dy, hw);
+    __m128 drdAhw = _mm_mul_ps(drdA, hw);
+
+    _mm_store_ps(J->resF.data() + g, _mm_mul_ps(residual, hw));
+    _mm_store_ps(J->JIdx[0].data() + g, dx);
+    _mm_store_ps(J->JIdx[1].data() + g, dy);
+    _mm_store_ps(J->JabF[0].data() + g, _mm_and_ps(maskA, drdAhw));
+    _mm_store_ps(J->JabF[1].data() + g, _mm_and_ps(maskB, hw));
+
+    JIdxJIdx_00 = _mm_add_ps(JIdxJIdx_00, _mm_mul_ps(dx, dx));
+    JIdxJIdx_11 = _mm_add_ps(JIdxJIdx_11, _mm_mul_ps(dy, dy));
+    JIdxJIdx_10 = _mm_add_ps(JIdxJIdx_10, _mm_mul_ps(dx, dy));
+
+    JabJIdx_00 = _mm_add_ps(JabJIdx_00, _mm_mul_ps(drdAhw, dx));
+    JabJIdx_01 = _mm_add_ps(JabJIdx_01, _mm_mul_ps(drdAhw, dy));
+    JabJIdx_10 = _mm_add_ps(JabJIdx_10, _mm_mul_ps(hw, dx));
+    JabJIdx_11 = _mm_add_ps(JabJIdx_11, _mm_mul_ps(hw, dy));
+
+    JabJab_00 = _mm_add_ps(JabJab_00, _mm_mul_ps(drdAhw, drdAhw));
+    JabJab_01 = _mm_add_ps(JabJab_01, _mm_mul_ps(drdAhw, hw));
+    JabJab_11 = _mm_add_ps(JabJab_11, _mm_mul_ps(hw, hw));
+
+    wJI2_sum = _mm_add_ps(
+        wJI2_sum,
+        _mm_mul_ps(_mm_mul_ps(hw, hw),
+                   _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))));
+  }
+  energyLeft = hsumSSE(energy4);
+
+  J->JIdx2(0, 0) = hsumSSE(JIdxJIdx_00);
+  J->JIdx2(0, 1) = hsumSSE(JIdxJIdx_10);
+  J->JIdx2(1, 0) = hsumSSE(JIdxJIdx_10);
+  J->JIdx2(1, 1) = hsumSSE(JIdxJIdx_11);
+  J->JabJIdx(0, 0) = hsumSSE(JabJIdx_00);
+  J->JabJIdx(0, 1) = hsumSSE(JabJIdx_01);
+  J->JabJIdx(1, 0) = hsumSSE(JabJIdx_10);
+  J->JabJIdx(1, 1) = hsumSSE(JabJIdx_11);
+  J->Jab2(0, 0) = hsumSSE(JabJab_00);
+  J->Jab2(0, 1) = hsumSSE(JabJab_01);
+  J->Jab2(1, 0) = hsumSSE(JabJab_01);
+  J->Jab2(1, 1) = hsumSSE(JabJab_11);
 
   state_NewEnergyWithOutlier = energyLeft;
 
   if (energyLeft >
           std::max<float>(host->frameEnergyTH, target->frameEnergyTH) ||
-      wJI2_sum < 2) {
+      hsumSSE(wJI2_sum) < 2) {
     energyLeft = std::max<float>(host->frameEnergyTH, target->frameEnergyTH);
     state_NewState = ResState::OUTLIER;
   } else {
@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include "util/ObjectPool.h"
 #include "util/globalCalib.h"
 #include "vector"
 
@@ -48,7 +49,7 @@ struct FullJacRowT {
 
 class PointFrameResidual {
 public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  DSO_POOLED_OPERATOR_NEW(PointFrameResidual);
 
   EFResidual *efResidual;
 
@@ -77,6 +78,7 @@ public:
   PointFrameResidual(PointHessian *point_, FrameHessian *host_,
                      FrameHessian *target_);
   double linearize(CalibHessian *HCalib);
+  template <typename Pattern> double linearizePattern(CalibHessian *HCalib);
 
   void resetOOB() {
     state_NewEnergy = state_energy = 0;
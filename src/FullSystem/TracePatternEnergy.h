@@ -0,0 +1,112 @@
+// Copyright (C) <2020> <Jiawei Mo, Junaed Sattar>
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// This file is modified from <https://github.com/JakobEngel/dso>
+
+#pragma once
+#include "util/globalFuncs.h"
+
+#if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
+#include "SSE2NEON.h"
+#endif
+
+namespace dso {
+
+// energy of the pattern at (ptx, pty) for the discrete epipolar search of
+// ImmaturePoint::traceOn: huber weighted residuals of the n rotated pattern
+// offsets against refColor, non-finite colors cost 1e5.
+EIGEN_ALWAYS_INLINE float tracePatternEnergy(const Eigen::Vector3f *dI, int w,
+                                             float ptx, float pty,
+                                             const Vec2f *pattern,
+                                             const float *refColor, int n,
+                                             float huberTH) {
+  float energy = 0;
+  for (int idx = 0; idx < n; idx++) {
+    float hitColor = getInterpolatedElement31(
+        dI, (float)(ptx + pattern[idx][0]), (float)(pty + pattern[idx][1]), w);
+
+    if (!std::isfinite(hitColor)) {
+      energy += 1e5;
+      continue;
+    }
+    float residual = hitColor - refColor[idx];
+    float hw = fabs(residual) < huberTH ? 1 : huberTH / fabs(residual);
+    energy += hw * residual * residual * (2 - hw);
+  }
+  return energy;
+}
+
+// energy of the pattern at (ptx, pty) for the discrete epipolar search, with
+// the 8 pattern pixels in two SSE registers. matches the scalar loop up to the
+// summation order; only the bilinear corner loads are scalar.
+EIGEN_ALWAYS_INLINE float
+tracePatternEnergySSE(const Eigen::Vector3f *dI, int w, float ptx, float pty,
+                      const float *patX, const float *patY,
+                      const float *refColor, float huberTH) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 huberTH4 = _mm_set1_ps(huberTH);
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 energy = _mm_setzero_ps();
+
+  for (int h = 0; h < 8; h += 4) {
+    __m128 px = _mm_add_ps(_mm_set1_ps(ptx), _mm_load_ps(patX + h));
+    __m128 py = _mm_add_ps(_mm_set1_ps(pty), _mm_load_ps(patY + h));
+    __m128i ix = _mm_cvttps_epi32(px);
+    __m128i iy = _mm_cvttps_epi32(py);
+    __m128 dx = _mm_sub_ps(px, _mm_cvtepi32_ps(ix));
+    __m128 dy = _mm_sub_ps(py, _mm_cvtepi32_ps(iy));
+
+    EIGEN_ALIGN16 int ixs[4], iys[4];
+    EIGEN_ALIGN16 float c00[4], c10[4], c01[4], c11[4];
+    _mm_store_si128((__m128i *)ixs, ix);
+    _mm_store_si128((__m128i *)iys, iy);
+    for (int k = 0; k < 4; k++) {
+      const Eigen::Vector3f *bp = dI + ixs[k] + iys[k] * w;
+      c00[k] = bp[0][0];
+      c10[k] = bp[1][0];
+      c01[k] = bp[w][0];
+      c11[k] = bp[1 + w][0];
+    }
+
+    __m128 dxdy = _mm_mul_ps(dx, dy);
+    __m128 hit = _mm_mul_ps(dxdy, _mm_load_ps(c11));
+    hit = _mm_add_ps(hit, _mm_mul_ps(_mm_sub_ps(dy, dxdy), _mm_load_ps(c01)));
+    hit = _mm_add_ps(hit, _mm_mul_ps(_mm_sub_ps(dx, dxdy), _mm_load_ps(c10)));
+    hit = _mm_add_ps(
+        hit, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_sub_ps(one, dx), dy), dxdy),
+                        _mm_load_ps(c00)));
+
+    __m128 residual = _mm_sub_ps(hit, _mm_load_ps(refColor + h));
+    __m128 absRes = _mm_and_ps(residual, absMask);
+    __m128 inlier = _mm_cmplt_ps(absRes, huberTH4);
+    __m128 hw = _mm_or_ps(_mm_and_ps(inlier, one),
+                          _mm_andnot_ps(inlier, _mm_div_ps(huberTH4, absRes)));
+    __m128 e = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(hw, residual), residual),
+                          _mm_sub_ps(two, hw));
+
+    // non-finite colors (hit - hit is not 0) are penalized with 1e5.
+    __m128 finite = _mm_cmpeq_ps(_mm_sub_ps(hit, hit), _mm_setzero_ps());
+    e = _mm_or_ps(_mm_and_ps(finite, e),
+                  _mm_andnot_ps(finite, _mm_set1_ps(1e5f)));
+    energy = _mm_add_ps(energy, e);
+  }
+
+  EIGEN_ALIGN16 float e4[4];
+  _mm_store_ps(e4, energy);
+  return (e4[0] + e4[1]) + (e4[2] + e4[3]);
+}
+
+} // namespace dso
@@ -80,7 +80,7 @@ void AccumulatedSCHessianSSE::addPoint(EFPoint *p, bool shiftPriorToZero,
 void AccumulatedSCHessianSSE::stitchDoubleInternal(
     MatXX *H, VecX *b, EnergyFunctional const *const EF, int min, int max,
     Vec10 *stats, int tid) {
-  int toAggregate = NUM_THREADS;
+  int toAggregate = setting_numThreads;
   if (tid == -1) {
     toAggregate = 1;
     tid = 0;
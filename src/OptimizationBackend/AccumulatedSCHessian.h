@@ -89,12 +89,12 @@ public:
                       EnergyFunctional const *const EF, bool MT) {
     // sum up, splitting by bock in square.
     if (MT) {
-      MatXX Hs[NUM_THREADS];
-      VecX bs[NUM_THREADS];
-      for (int i = 0; i < NUM_THREADS; i++) {
+      MatXX *Hs = stitchH;
+      VecX *bs = stitchb;
+      for (int i = 0; i < setting_numThreads; i++) {
         assert(nframes[0] == nframes[i]);
-        Hs[i] = MatXX::Zero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
-        bs[i] = VecX::Zero(nframes[0] * 8 + CPARS);
+        Hs[i].setZero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
+        bs[i].setZero(nframes[0] * 8 + CPARS);
       }
 
       red->reduce(boost::bind(&AccumulatedSCHessianSSE::stitchDoubleInternal,
@@ -105,13 +105,13 @@ public:
       H = Hs[0];
       b = bs[0];
 
-      for (int i = 1; i < NUM_THREADS; i++) {
+      for (int i = 1; i < setting_numThreads; i++) {
         H.noalias() += Hs[i];
         b.noalias() += bs[i];
       }
     } else {
-      H = MatXX::Zero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
-      b = VecX::Zero(nframes[0] * 8 + CPARS);
+      H.setZero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
+      b.setZero(nframes[0] * 8 + CPARS);
       stitchDoubleInternal(&H, &b, EF, 0, nframes[0] * nframes[0], 0, -1);
     }
 
@@ -130,6 +130,11 @@ public:
   AccumulatorX<CPARS> accbc[NUM_THREADS];
   int nframes[NUM_THREADS];
 
+  // per thread results of stitchDoubleMT, kept so they are only reallocated
+  // when the window size changes.
+  MatXX stitchH[NUM_THREADS];
+  VecX stitchb[NUM_THREADS];
+
   void addPointsInternal(std::vector<EFPoint *> *points, bool shiftPriorToZero,
                          int min = 0, int max = 1, Vec10 *stats = 0,
                          int tid = 0) {
@@ -65,6 +65,8 @@ void AccumulatedTopHessianSSE::addPoint(
     RawResidualJacobian *rJ = r->J;
     int htIDX = r->hostIDX + r->targetIDX * nframes[tid];
     Mat18f dp = ef->adHTdeltaF[htIDX];
+    assert(pairIdx[htIDX] >= 0);
+    AccumulatorApprox &pairAcc = acc[tid][pairIdx[htIDX]];
 
     VecNRf resApprox;
     if (mode == 0)
@@ -109,14 +111,14 @@ void AccumulatedTopHessianSSE::addPoint(
       rr += resApprox[i] * resApprox[i];
     }
 
-    acc[tid][htIDX].update(rJ->Jpdc[0].data(), rJ->Jpdxi[0].data(),
-                           rJ->Jpdc[1].data(), rJ->Jpdxi[1].data(),
-                           rJ->JIdx2(0, 0), rJ->JIdx2(0, 1), rJ->JIdx2(1, 1));
+    pairAcc.update(rJ->Jpdc[0].data(), rJ->Jpdxi[0].data(), rJ->Jpdc[1].data(),
+                   rJ->Jpdxi[1].data(), rJ->JIdx2(0, 0), rJ->JIdx2(0, 1),
+                   rJ->JIdx2(1, 1));
 
-    acc[tid][htIDX].updateBotRight(rJ->Jab2(0, 0), rJ->Jab2(0, 1), Jab_r[0],
-                                   rJ->Jab2(1, 1), Jab_r[1], rr);
+    pairAcc.updateBotRight(rJ->Jab2(0, 0), rJ->Jab2(0, 1), Jab_r[0],
+                           rJ->Jab2(1, 1), Jab_r[1], rr);
 
-    acc[tid][htIDX].updateTopRight(
+    pairAcc.updateTopRight(
         rJ->Jpdc[0].data(), rJ->Jpdxi[0].data(), rJ->Jpdc[1].data(),
         rJ->Jpdxi[1].data(), rJ->JabJIdx(0, 0), rJ->JabJIdx(0, 1),
         rJ->JabJIdx(1, 0), rJ->JabJIdx(1, 1), JI_r[0], JI_r[1]);
@@ -152,6 +154,25 @@ template void AccumulatedTopHessianSSE::addPoint<1>(
 template void AccumulatedTopHessianSSE::addPoint<2>(
     EFPoint *p, EnergyFunctional const *const ef, int tid);
 
+void AccumulatedTopHessianSSE::setActivePairs(
+    EnergyFunctional const *const EF) {
+  int nFrames = EF->nFrames;
+  pairIdx.assign(nFrames * nFrames, -1);
+  pairs.clear();
+
+  // slots are ordered by target, then host, same as the dense layout.
+  for (int t = 0; t < nFrames; t++)
+    for (int h = 0; h < nFrames; h++) {
+      auto it = EF->connectivityMap.find(
+          (((uint64_t)EF->frames[h]->frameID) << 32) +
+          ((uint64_t)EF->frames[t]->frameID));
+      if (it == EF->connectivityMap.end() || it->second[0] <= 0)
+        continue;
+      pairIdx[h + nFrames * t] = pairs.size();
+      pairs.push_back(h + nFrames * t);
+    }
+}
+
 void AccumulatedTopHessianSSE::stitchDouble(MatXX &H, VecX &b,
                                             EnergyFunctional const *const EF,
                                             bool usePrior, bool useDelta,
@@ -159,47 +180,48 @@ void AccumulatedTopHessianSSE::stitchDouble(MatXX &H, VecX &b,
   H = MatXX::Zero(nframes[tid] * 8 + CPARS, nframes[tid] * 8 + CPARS);
   b = VecX::Zero(nframes[tid] * 8 + CPARS);
 
-  for (int h = 0; h < nframes[tid]; h++)
-    for (int t = 0; t < nframes[tid]; t++) {
-      int hIdx = CPARS + h * 8;
-      int tIdx = CPARS + t * 8;
-      int aidx = h + nframes[tid] * t;
+  for (int k = 0; k < (int)pairs.size(); k++) {
+    int aidx = pairs[k];
+    int h = aidx % nframes[tid];
+    int t = aidx / nframes[tid];
+    int hIdx = CPARS + h * 8;
+    int tIdx = CPARS + t * 8;
 
-      acc[tid][aidx].finish();
-      if (acc[tid][aidx].num == 0)
-        continue;
+    acc[tid][k].finish();
+    if (acc[tid][k].num == 0)
+      continue;
 
-      MatPCPC accH = acc[tid][aidx].H.cast<double>();
+    MatPCPC accH = acc[tid][k].H.cast<double>();
 
-      H.block<8, 8>(hIdx, hIdx).noalias() += EF->adHost[aidx] *
-                                             accH.block<8, 8>(CPARS, CPARS) *
-                                             EF->adHost[aidx].transpose();
+    H.block<8, 8>(hIdx, hIdx).noalias() += EF->adHost[aidx] *
+                                           accH.block<8, 8>(CPARS, CPARS) *
+                                           EF->adHost[aidx].transpose();
 
-      H.block<8, 8>(tIdx, tIdx).noalias() += EF->adTarget[aidx] *
-                                             accH.block<8, 8>(CPARS, CPARS) *
-                                             EF->adTarget[aidx].transpose();
+    H.block<8, 8>(tIdx, tIdx).noalias() += EF->adTarget[aidx] *
+                                           accH.block<8, 8>(CPARS, CPARS) *
+                                           EF->adTarget[aidx].transpose();
 
-      H.block<8, 8>(hIdx, tIdx).noalias() += EF->adHost[aidx] *
-                                             accH.block<8, 8>(CPARS, CPARS) *
-                                             EF->adTarget[aidx].transpose();
+    H.block<8, 8>(hIdx, tIdx).noalias() += EF->adHost[aidx] *
+                                           accH.block<8, 8>(CPARS, CPARS) *
+                                           EF->adTarget[aidx].transpose();
 
-      H.block<8, CPARS>(hIdx, 0).noalias() +=
-          EF->adHost[aidx] * accH.block<8, CPARS>(CPARS, 0);
+    H.block<8, CPARS>(hIdx, 0).noalias() +=
+        EF->adHost[aidx] * accH.block<8, CPARS>(CPARS, 0);
 
-      H.block<8, CPARS>(tIdx, 0).noalias() +=
-          EF->adTarget[aidx] * accH.block<8, CPARS>(CPARS, 0);
+    H.block<8, CPARS>(tIdx, 0).noalias() +=
+        EF->adTarget[aidx] * accH.block<8, CPARS>(CPARS, 0);
 
-      H.topLeftCorner<CPARS, CPARS>().noalias() +=
-          accH.block<CPARS, CPARS>(0, 0);
+    H.topLeftCorner<CPARS, CPARS>().noalias() +=
+        accH.block<CPARS, CPARS>(0, 0);
 
-      b.segment<8>(hIdx).noalias() +=
-          EF->adHost[aidx] * accH.block<8, 1>(CPARS, 8 + CPARS);
+    b.segment<8>(hIdx).noalias() +=
+        EF->adHost[aidx] * accH.block<8, 1>(CPARS, 8 + CPARS);
 
-      b.segment<8>(tIdx).noalias() +=
-          EF->adTarget[aidx] * accH.block<8, 1>(CPARS, 8 + CPARS);
+    b.segment<8>(tIdx).noalias() +=
+        EF->adTarget[aidx] * accH.block<8, 1>(CPARS, 8 + CPARS);
 
-      b.head<CPARS>().noalias() += accH.block<CPARS, 1>(0, 8 + CPARS);
-    }
+    b.head<CPARS>().noalias() += accH.block<CPARS, 1>(0, 8 + CPARS);
+  }
 
   // ----- new: copy transposed parts.
   for (int h = 0; h < nframes[tid]; h++) {
@@ -231,31 +253,31 @@ void AccumulatedTopHessianSSE::stitchDouble(MatXX &H, VecX &b,
 void AccumulatedTopHessianSSE::stitchDoubleInternal(
     MatXX *H, VecX *b, EnergyFunctional const *const EF, bool usePrior, int min,
     int max, Vec10 *stats, int tid) {
-  int toAggregate = NUM_THREADS;
-  if (tid == -1) {
+  int toAggregate = setting_numThreads;
+  bool singleThread = tid == -1;
+  if (singleThread) {
     toAggregate = 1;
     tid = 0;
   } // special case: if we dont do multithreading, dont aggregate.
-  if (min == max)
+  // without any pairs the single threaded call still has to add the prior.
+  if (min == max && !singleThread)
     return;
 
   for (int k = min; k < max; k++) {
-    int h = k % nframes[0];
-    int t = k / nframes[0];
+    int aidx = pairs[k];
+    int h = aidx % nframes[0];
+    int t = aidx / nframes[0];
 
     int hIdx = CPARS + h * 8;
     int tIdx = CPARS + t * 8;
-    int aidx = h + nframes[0] * t;
-
-    assert(aidx == k);
 
     MatPCPC accH = MatPCPC::Zero();
 
     for (int tid2 = 0; tid2 < toAggregate; tid2++) {
-      acc[tid2][aidx].finish();
-      if (acc[tid2][aidx].num == 0)
+      acc[tid2][k].finish();
+      if (acc[tid2][k].num == 0)
         continue;
-      accH += acc[tid2][aidx].H.cast<double>();
+      accH += acc[tid2][k].H.cast<double>();
     }
 
     H[tid].block<8, 8>(hIdx, hIdx).noalias() += EF->adHost[aidx] *
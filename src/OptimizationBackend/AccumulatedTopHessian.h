@@ -42,6 +42,7 @@ public:
       nres[tid] = 0;
       acc[tid] = 0;
       nframes[tid] = 0;
+      accCapacity[tid] = 0;
     }
   };
   inline ~AccumulatedTopHessianSSE() {
@@ -51,20 +52,31 @@ public:
     }
   };
 
+  // builds the sparse layout (pairIdx, pairs) from EF->connectivityMap: only
+  // host-target pairs that hold residuals get an accumulator. has to be
+  // called once, single threaded, before setZero.
+  void setActivePairs(EnergyFunctional const *const EF);
+
+  // accumulators are kept between calls and only reallocated if the layout
+  // outgrows them, which then makes room for every pair of the window.
+  // only the accumulators in use are zeroed.
   inline void setZero(int nFrames, int min = 0, int max = 1, Vec10 *stats = 0,
                       int tid = 0) {
+    assert((int)pairIdx.size() == nFrames * nFrames);
+    int nPairs = pairs.size();
 
-    if (nFrames != nframes[tid]) {
+    if (nPairs > accCapacity[tid]) {
       if (acc[tid] != 0)
         delete[] acc[tid];
+      accCapacity[tid] = nFrames * nFrames;
 #if USE_XI_MODEL
-      acc[tid] = new Accumulator14[nFrames * nFrames];
+      acc[tid] = new Accumulator14[accCapacity[tid]];
 #else
-      acc[tid] = new AccumulatorApprox[nFrames * nFrames];
+      acc[tid] = new AccumulatorApprox[accCapacity[tid]];
 #endif
     }
 
-    for (int i = 0; i < nFrames * nFrames; i++) {
+    for (int i = 0; i < nPairs; i++) {
       acc[tid][i].initialize();
     }
 
@@ -80,34 +92,34 @@ public:
   void stitchDoubleMT(IndexThreadReduce<Vec10> *red, MatXX &H, VecX &b,
                       EnergyFunctional const *const EF, bool usePrior,
                       bool MT) {
-    // sum up, splitting by bock in square.
-    if (MT) {
-      MatXX Hs[NUM_THREADS];
-      VecX bs[NUM_THREADS];
-      for (int i = 0; i < NUM_THREADS; i++) {
+    // sum up, splitting by bock in square. with no pairs at all there is
+    // nothing to split, only the prior.
+    if (MT && !pairs.empty()) {
+      MatXX *Hs = stitchH;
+      VecX *bs = stitchb;
+      for (int i = 0; i < setting_numThreads; i++) {
         assert(nframes[0] == nframes[i]);
-        Hs[i] = MatXX::Zero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
-        bs[i] = VecX::Zero(nframes[0] * 8 + CPARS);
+        Hs[i].setZero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
+        bs[i].setZero(nframes[0] * 8 + CPARS);
       }
 
       red->reduce(boost::bind(&AccumulatedTopHessianSSE::stitchDoubleInternal,
                               this, Hs, bs, EF, usePrior, _1, _2, _3, _4),
-                  0, nframes[0] * nframes[0], 0);
+                  0, pairs.size(), 0);
 
       // sum up results
       H = Hs[0];
       b = bs[0];
 
-      for (int i = 1; i < NUM_THREADS; i++) {
+      for (int i = 1; i < setting_numThreads; i++) {
         H.noalias() += Hs[i];
         b.noalias() += bs[i];
         nres[0] += nres[i];
       }
     } else {
-      H = MatXX::Zero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
-      b = VecX::Zero(nframes[0] * 8 + CPARS);
-      stitchDoubleInternal(&H, &b, EF, usePrior, 0, nframes[0] * nframes[0], 0,
-                           -1);
+      H.setZero(nframes[0] * 8 + CPARS, nframes[0] * 8 + CPARS);
+      b.setZero(nframes[0] * 8 + CPARS);
+      stitchDoubleInternal(&H, &b, EF, usePrior, 0, pairs.size(), 0, -1);
     }
 
     // make diagonal by copying over parts.
@@ -128,7 +140,18 @@ public:
 
   int nframes[NUM_THREADS];
 
+  // per thread results of stitchDoubleMT, kept so they are only reallocated
+  // when the window size changes.
+  MatXX stitchH[NUM_THREADS];
+  VecX stitchb[NUM_THREADS];
+
   EIGEN_ALIGN16 AccumulatorApprox *acc[NUM_THREADS];
+  int accCapacity[NUM_THREADS];
+
+  // pairIdx maps h + t*nframes to the slot in acc, or -1 if that pair has no
+  // residuals. pairs holds h + t*nframes for every slot.
+  std::vector<int> pairIdx;
+  std::vector<int> pairs;
 
   int nres[NUM_THREADS];
 
@@ -28,6 +28,8 @@
 #include "FullSystem/FullSystem.h"
 #include "FullSystem/HessianBlocks.h"
 #include "FullSystem/Residuals.h"
+#include "SparseKKTSolver.h"
+#include <chrono>
 
 #if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
 #include "SSE2NEON.h"
@@ -125,6 +127,11 @@ EnergyFunctional::EnergyFunctional() {
   accSSE_top_L = new AccumulatedTopHessianSSE();
   accSSE_top_A = new AccumulatedTopHessianSSE();
   accSSE_bot = new AccumulatedSCHessianSSE();
+  kktSolver = new SparseKKTSolver();
+  statistics_solveMs = 0;
+  statistics_numSolves = 0;
+  statistics_solveResidual = 0;
+  statistics_maxSolveResidual = 0;
 
   resInA = resInL = resInM = 0;
   currentLambda = 0;
@@ -158,6 +165,7 @@ EnergyFunctional::~EnergyFunctional() {
   delete accSSE_top_L;
   delete accSSE_top_A;
   delete accSSE_bot;
+  delete kktSolver;
 }
 
 void EnergyFunctional::setDeltaF(CalibHessian *HCalib) {
@@ -195,6 +203,7 @@ void EnergyFunctional::setDeltaF(CalibHessian *HCalib) {
 
 // accumulates & shifts L.
 void EnergyFunctional::accumulateAF_MT(MatXX &H, VecX &b, bool MT) {
+  accSSE_top_A->setActivePairs(this);
   if (MT) {
     red->reduce(boost::bind(&AccumulatedTopHessianSSE::setZero, accSSE_top_A,
                             nFrames, _1, _2, _3, _4),
@@ -216,6 +225,7 @@ void EnergyFunctional::accumulateAF_MT(MatXX &H, VecX &b, bool MT) {
 
 // accumulates & shifts L.
 void EnergyFunctional::accumulateLF_MT(MatXX &H, VecX &b, bool MT) {
+  accSSE_top_L->setActivePairs(this);
   if (MT) {
     red->reduce(boost::bind(&AccumulatedTopHessianSSE::setZero, accSSE_top_L,
                             nFrames, _1, _2, _3, _4),
@@ -253,42 +263,65 @@ void EnergyFunctional::accumulateSCF_MT(MatXX &H, VecX &b, bool MT) {
   }
 }
 
-void EnergyFunctional::expandHbtoFitImu(MatXX &H, VecX &b) {
+void SolverWorkspace::reserve(int nFrames) {
   int dim = CPARS + 3 + 29 * nFrames;
-  MatXX He = MatXX::Zero(dim, dim);
-  VecX be = VecX::Zero(dim);
+  int maxCst = 6 * nFrames;
+  if (H.rows() < dim) {
+    H.resize(dim, dim);
+    b.resize(dim);
+    keep.reserve(dim);
+    reducedIdx.reserve(dim);
+  }
+  if (K.rows() < dim + maxCst) {
+    K.resize(dim + maxCst, dim + maxCst);
+    k.resize(dim + maxCst);
+    S.resize(dim + maxCst);
+    r_cst.resize(maxCst);
+    J_cst.reserve(maxCst * 21);
+    is_spline_valid.reserve(nFrames);
+    imuFrames.reserve(nFrames);
+  }
+}
 
+// adds the dso system H, b (CPARS + 8 * nFrames), scaled by Hfac and bfac,
+// into He, be in the imu layout (CPARS + 3 + 29 * nFrames).
+void EnergyFunctional::expandHbtoFitImu(const MatXX &H, const VecX &b,
+                                        double Hfac, double bfac, MatXX &He,
+                                        VecX &be) {
   // H: cam - cam
-  He.topLeftCorner<CPARS, CPARS>() = H.topLeftCorner<CPARS, CPARS>();
+  He.topLeftCorner<CPARS, CPARS>() += Hfac * H.topLeftCorner<CPARS, CPARS>();
   // b: cam
-  be.head(CPARS) = b.head(CPARS);
+  be.head<CPARS>() += bfac * b.head<CPARS>();
   for (int i = 0; i < nFrames; i++) {
     int fi = CPARS + 8 * i;
     int fie = CPARS + 3 + 29 * i;
     // H: cam - xi_ab_i
-    He.block(0, fie, CPARS, 8) += H.block(0, fi, CPARS, 8);
-    He.block(fie, 0, 8, CPARS) += H.block(fi, 0, 8, CPARS);
-    // H: xi_ab_i - xi_ab_i
-    He.block(fie, fie, 8, 8) += H.block(fi, fi, 8, 8);
+    He.block<CPARS, 8>(0, fie) += Hfac * H.block<CPARS, 8>(0, fi);
+    He.block<8, CPARS>(fie, 0) += Hfac * H.block<8, CPARS>(fi, 0);
     // H: xi_ab_i - xi_ab_j
-    for (int j = i + 1; j < nFrames; j++) {
+    for (int j = 0; j < nFrames; j++) {
       int fj = CPARS + 8 * j;
       int fje = CPARS + 3 + 29 * j;
-      He.block(fie, fje, 8, 8) += H.block(fi, fj, 8, 8);
-      He.block(fje, fie, 8, 8) += H.block(fj, fi, 8, 8);
+      He.block<8, 8>(fie, fje) += Hfac * H.block<8, 8>(fi, fj);
     }
     // b: xi_ab_i
-    be.segment<8>(fie) += b.segment<8>(fi);
+    be.segment<8>(fie) += bfac * b.segment<8>(fi);
   }
+}
 
-  H = He.eval();
-  b = be.eval();
+// appends the non zero entries of a 3x3 jacobian block.
+static inline void addCstBlock(std::vector<Eigen::Triplet<double>> &J, int row,
+                               int col, const Mat33 &block) {
+  for (int c = 0; c < 3; c++)
+    for (int r = 0; r < 3; r++)
+      if (block(r, c) != 0)
+        J.push_back(Eigen::Triplet<double>(row + r, col + c, block(r, c)));
 }
 
+// imu terms between frame fi - 1 and fi. only written to f, so frames can be
+// done in parallel, addImuFrameHessian puts them into the system.
 void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
-                                                 MatXX &H, VecX &b,
-                                                 bool &spline_valid,
-                                                 MatXX &J_cst, VecX &r_cst,
+                                                 ImuFrameHessian &f,
                                                  bool print) {
   assert(fi > 0);
   Mat33 I33 = Mat33::Identity();
@@ -302,47 +335,45 @@ void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
   int prv_idx = CPARS + 3 + 29 * (fi - 1);
 
   /************************* imu bias error ****************************/
-  Mat66 tmpH = setting_weight_imu_bias / -tpf;
-  tmpH.topLeftCorner<3, 3>() *= (SCALE_BA * SCALE_BA);
-  tmpH.bottomRightCorner<3, 3>() *= (SCALE_BG * SCALE_BG);
-  H.block(prv_idx + 8, prv_idx + 8, 6, 6) += tmpH;
-  H.block(cur_idx + 8, cur_idx + 8, 6, 6) += tmpH;
-  H.block(prv_idx + 8, cur_idx + 8, 6, 6) += -tmpH;
-  H.block(cur_idx + 8, prv_idx + 8, 6, 6) += -tmpH;
+  f.Hbias = setting_weight_imu_bias / -tpf;
+  f.Hbias.topLeftCorner<3, 3>() *= (SCALE_BA * SCALE_BA);
+  f.Hbias.bottomRightCorner<3, 3>() *= (SCALE_BG * SCALE_BG);
   Vec6 r_imu_bias = cur_fh->imu_bias - prv_fh->imu_bias;
-  Vec6 tmpb = (setting_weight_imu_bias / -tpf) * r_imu_bias;
-  tmpb.head(3) *= SCALE_BA;
-  tmpb.tail(3) *= SCALE_BG;
-  b.segment<6>(prv_idx + 8) += -tmpb;
-  b.segment<6>(cur_idx + 8) += tmpb;
-
-  spline_valid = (cur_fh->shell->trackingRef == prv_fh->shell) &&
-                 (-tpf < setting_maxImuInterval);  // 计算spline是否有效
+  f.bbias = (setting_weight_imu_bias / -tpf) * r_imu_bias;
+  f.bbias.head(3) *= SCALE_BA;
+  f.bbias.tail(3) *= SCALE_BG;
+
+  f.spline_valid = (cur_fh->shell->trackingRef == prv_fh->shell) &&
+                   (-tpf < setting_maxImuInterval);  // 计算spline是否有效
   bool vel_valid = fi < (nFrames - 1);
-  if (spline_valid) {
+  // rows of this frame in f.J_cst / f.r_cst, the velocity rows only exist if
+  // the next frame is constrained as well.
+  f.J_cst.clear();
+  f.ncst = 0;
+  int rot_row = 0;
+  int vel_row = -1;
+  f.Hss.setZero();
+  f.Hfs.setZero();
+  f.Hff.setZero();
+  f.bs.setZero();
+  f.bf.setZero();
+  if (f.spline_valid) {
     /*********************** spline constraint *************************/
-    int dim = CPARS + 3 + 29 * nFrames;
-    if (vel_valid) {
-      r_cst = VecX::Zero(6);
-      J_cst = MatXX::Zero(6, dim);
-    } else {
-      r_cst = VecX::Zero(3);
-      J_cst = MatXX::Zero(3, dim);
-    }
-
     // rotation
     Mat33 rot_c_p_pred = cur_fh->getSplineR_c_t(tpf);
     Mat33 rot_c_p_meas =
         (cur_fh->PRE_camToWorld.inverse() * prv_fh->PRE_camToWorld)
             .rotationMatrix();
-    r_cst.segment<3>(0) = SO3(rot_c_p_meas.transpose() * rot_c_p_pred).log();
+    f.r_cst.segment<3>(rot_row) =
+        SO3(rot_c_p_meas.transpose() * rot_c_p_pred).log();
     Mat33 rot_p_w_evalPT =
         prv_fh->get_camToWorld_evalPT().rotationMatrix().transpose();
-    J_cst.block<3, 3>(0, prv_idx + 3) = -SCALE_XI_ROT * rot_p_w_evalPT;
-    J_cst.block<3, 3>(0, cur_idx + 3) = SCALE_XI_ROT * rot_p_w_evalPT;
-    J_cst.block<3, 3>(0, cur_idx + 14) = SCALE_SL_ROT * tpf * I33;
-    J_cst.block<3, 3>(0, cur_idx + 20) = SCALE_SQ_ROT * tpf2 * I33;
-    J_cst.block<3, 3>(0, cur_idx + 26) = SCALE_SC_ROT * tpf * tpf2 * I33;
+    addCstBlock(f.J_cst, rot_row, prv_idx + 3, -SCALE_XI_ROT * rot_p_w_evalPT);
+    addCstBlock(f.J_cst, rot_row, cur_idx + 3, SCALE_XI_ROT * rot_p_w_evalPT);
+    addCstBlock(f.J_cst, rot_row, cur_idx + 14, SCALE_SL_ROT * tpf * I33);
+    addCstBlock(f.J_cst, rot_row, cur_idx + 20, SCALE_SQ_ROT * tpf2 * I33);
+    addCstBlock(f.J_cst, rot_row, cur_idx + 26, SCALE_SC_ROT * tpf * tpf2 * I33);
+    f.ncst += 3;
 
     // velocity
     if (vel_valid) {
@@ -359,15 +390,18 @@ void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
         Vec3 d_vel_imu = (tpf * cur_fh->spline_q + tpf2 * cur_fh->spline_c +
                           tnf * nxt_fh->spline_q + 2 * tnf2 * nxt_fh->spline_c)
                              .head(3);
-        r_cst.segment<3>(3) = d_vel_imu - d_vel_dso;
-        J_cst.block<3, 3>(3, prv_idx) = -SCALE_XI_TRANS / tpf * I33;
-        J_cst.block<3, 3>(3, cur_idx) =
-            SCALE_XI_TRANS * (1 / tpf + 1 / tnf) * I33;
-        J_cst.block<3, 3>(3, nxt_idx) = -SCALE_XI_TRANS / tnf * I33;
-        J_cst.block<3, 3>(3, cur_idx + 17) = SCALE_SQ_TRANS * tpf * I33;
-        J_cst.block<3, 3>(3, cur_idx + 23) = SCALE_SC_TRANS * tpf2 * I33;
-        J_cst.block<3, 3>(3, nxt_idx + 17) = SCALE_SQ_TRANS * tnf * I33;
-        J_cst.block<3, 3>(3, nxt_idx + 23) = SCALE_SC_TRANS * 2 * tnf2 * I33;
+        vel_row = f.ncst;
+        f.r_cst.segment<3>(vel_row) = d_vel_imu - d_vel_dso;
+        addCstBlock(f.J_cst, vel_row, prv_idx, -SCALE_XI_TRANS / tpf * I33);
+        addCstBlock(f.J_cst, vel_row, cur_idx,
+                    SCALE_XI_TRANS * (1 / tpf + 1 / tnf) * I33);
+        addCstBlock(f.J_cst, vel_row, nxt_idx, -SCALE_XI_TRANS / tnf * I33);
+        addCstBlock(f.J_cst, vel_row, cur_idx + 17, SCALE_SQ_TRANS * tpf * I33);
+        addCstBlock(f.J_cst, vel_row, cur_idx + 23, SCALE_SC_TRANS * tpf2 * I33);
+        addCstBlock(f.J_cst, vel_row, nxt_idx + 17, SCALE_SQ_TRANS * tnf * I33);
+        addCstBlock(f.J_cst, vel_row, nxt_idx + 23,
+                    SCALE_SC_TRANS * 2 * tnf2 * I33);
+        f.ncst += 3;
       }
     }
 
@@ -376,24 +410,26 @@ void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
     Vec6 imu_meas_ave = Vec6::Zero();
     size_t imu_size = cur_fh->imu_data.size();
     int count = 0;
+    // spline and gravity for all samples, used for the residuals and, before
+    // the scale is trapped, for the jacobians as well.
+    ImuSamples &s = cur_fh->imu_samples;
+    cur_fh->evalImuSamples(HCalib, false, s);
+    Mat33 rot_c_w = cur_fh->PRE_worldToCam.rotationMatrix();
     if (HCalib->scale_trapped) {
-      H.block<3, 3>(CPARS, CPARS) += cur_fh->Hss;
-      H.block<29, 3>(cur_idx, CPARS) += cur_fh->Hfs;
-      H.block<3, 29>(CPARS, cur_idx) += cur_fh->Hfs.transpose();
-      H.block<29, 29>(cur_idx, cur_idx) += cur_fh->Hff;
+      f.Hss = cur_fh->Hss;
+      f.Hfs = cur_fh->Hfs;
+      f.Hff = cur_fh->Hff;
     }
     for (int j = 0; j < imu_size; j++) {
       // predict imu reading from spline  //! ===============重点：从spline预测IMU读数《《《《《《《《《《《《《《《
-      double tt = cur_fh->imu_data[j].timestamp - cur_fh->shell->timestamp;  //! 这里的时间应该是秒
+      double tt = s.tt[j];  //! 这里的时间应该是秒
       assert(tt <= 0);
 
       Vec6 imu_pred;  //! 利用tt和spline预测IMU读数 predict imu reading from spline using tt
-      imu_pred.head(3) = setting_rot_imu_cam *
-                         cur_fh->getSplineR_c_t(tt).transpose() *
-                         cur_fh->PRE_worldToCam.rotationMatrix() *
-                         (HCalib->getScaleScaled() * cur_fh->getSplineAcc(tt) +
-                          HCalib->getG());  //! equation 14 in spline vio paper
-      imu_pred.tail(3) = setting_rot_imu_cam * cur_fh->getSplineGryo(tt);  //! equation 16 in spline vio paper  可能就是从这里改！！！！！
+      Vec3 acc_w = s.scale_scaled * s.acc.col(j) + s.g;
+      imu_pred.head(3) =
+          setting_rot_imu_cam * (s.rot_t_c[j] * (rot_c_w * acc_w));  //! equation 14 in spline vio paper
+      imu_pred.tail(3) = s.gyro.col(j);  //! equation 16 in spline vio paper
       imu_pred += cur_fh->imu_bias;
       Vec6 imu_meas;   //! imu的测量值
       imu_meas.head(3) = cur_fh->imu_data[j].acc;      
@@ -401,22 +437,21 @@ void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
       Vec6 r_imu = imu_pred - imu_meas;  //! ==============计算IMU残差==================
 
       if (HCalib->scale_trapped) {
-        b.segment<3>(CPARS) += cur_fh->JsTW[j] * r_imu;
-        b.segment<29>(cur_idx) += cur_fh->JfTW[j] * r_imu;
+        f.bs += cur_fh->JsTW[j] * r_imu;
+        f.bf += cur_fh->JfTW[j] * r_imu;
       } else { // not use FEJ when initialization
         Mat36 JsTW;
         Mat296 JfTW;
         Mat33 Hss;
         Mat2929 Hff;
         Mat293 Hfs;
-        cur_fh->getImuHi(HCalib, tt, JsTW, JfTW, Hss, Hff, Hfs);  //! get imu info 
-        H.block<3, 3>(CPARS, CPARS) += Hss;    // CPARS = 4
-        H.block<29, 3>(cur_idx, CPARS) += Hfs;
-        H.block<3, 29>(CPARS, cur_idx) += Hfs.transpose();
-        H.block<29, 29>(cur_idx, cur_idx) += Hff;
-
-        b.segment<3>(CPARS) += JsTW * r_imu;
-        b.segment<29>(cur_idx) += JfTW * r_imu;
+        cur_fh->getImuHi(HCalib, s, j, JsTW, JfTW, Hss, Hff, Hfs);  //! get imu info 
+        f.Hss += Hss;
+        f.Hfs += Hfs;
+        f.Hff += Hff;
+
+        f.bs += JsTW * r_imu;
+        f.bf += JfTW * r_imu;
       }
 
       if (print) {
@@ -444,11 +479,12 @@ void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
            cur_fh->frameID, cur_fh->imu_bias[0], cur_fh->imu_bias[1],
            cur_fh->imu_bias[2], cur_fh->imu_bias[3], cur_fh->imu_bias[4],
            cur_fh->imu_bias[5]);  // 输出： 帧id，加速度bias，陀螺仪bias  //! 这些偏差是怎么得到的？？？？
-    if (spline_valid) {
-      if (vel_valid) {
-        printf("r_rv: %.0e %.0e\n", r_cst.head(3).norm(), r_cst.tail(3).norm());
+    if (f.spline_valid) {
+      if (vel_row >= 0) {
+        printf("r_rv: %.0e %.0e\n", f.r_cst.segment<3>(rot_row).norm(),
+               f.r_cst.segment<3>(vel_row).norm());
       } else {
-        printf("r_r:  %.0e\n", r_cst.norm());
+        printf("r_r:  %.0e\n", f.r_cst.segment<3>(rot_row).norm());
       }
     } else {
       printf("\n");
@@ -456,15 +492,61 @@ void EnergyFunctional::getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
   }
 }
 
-void EnergyFunctional::getImuHessian(MatXX &H, VecX &b, MatXX &J_cst,
-                                     VecX &r_cst, CalibHessian *HCalib,
-                                     std::vector<bool> &is_spline_valid,
+// adds the terms of frame fi into H, b (imu layout). if given, the
+// constraints are appended to J_cst / r_cst behind the cdim rows already
+// there.
+void EnergyFunctional::addImuFrameHessian(
+    int fi, const ImuFrameHessian &f, MatXX &H, VecX &b,
+    std::vector<Eigen::Triplet<double>> *J_cst, VecX *r_cst, int *cdim) {
+  int cur_idx = CPARS + 3 + 29 * fi;
+  int prv_idx = CPARS + 3 + 29 * (fi - 1);
+
+  H.block<6, 6>(prv_idx + 8, prv_idx + 8) += f.Hbias;
+  H.block<6, 6>(cur_idx + 8, cur_idx + 8) += f.Hbias;
+  H.block<6, 6>(prv_idx + 8, cur_idx + 8) -= f.Hbias;
+  H.block<6, 6>(cur_idx + 8, prv_idx + 8) -= f.Hbias;
+  b.segment<6>(prv_idx + 8) -= f.bbias;
+  b.segment<6>(cur_idx + 8) += f.bbias;
+  if (!f.spline_valid)
+    return;
+
+  H.block<3, 3>(CPARS, CPARS) += f.Hss;
+  H.block<29, 3>(cur_idx, CPARS) += f.Hfs;
+  H.block<3, 29>(CPARS, cur_idx) += f.Hfs.transpose();
+  H.block<29, 29>(cur_idx, cur_idx) += f.Hff;
+  b.segment<3>(CPARS) += f.bs;
+  b.segment<29>(cur_idx) += f.bf;
+
+  if (J_cst == 0)
+    return;
+  for (const Eigen::Triplet<double> &t : f.J_cst)
+    J_cst->push_back(
+        Eigen::Triplet<double>(*cdim + t.row(), t.col(), t.value()));
+  r_cst->segment(*cdim, f.ncst) = f.r_cst.head(f.ncst);
+  *cdim += f.ncst;
+}
+
+void EnergyFunctional::getImuHessianFrames(SolverWorkspace *ws,
+                                           CalibHessian *HCalib, bool print,
+                                           int min, int max, Vec10 *stats,
+                                           int tid) {
+  for (int i = min; i < max; i++)
+    getImuHessianCurrentFrame(i, HCalib, ws->imuFrames[i], print);
+}
+
+// adds the imu part into ws.H, ws.b (imu layout) and sets the spline
+// constraints and ws.is_spline_valid. the caller has to zero the top left
+// CPARS + 3 + 29 * nFrames of ws.H / ws.b, after ws.reserve(nFrames) for a
+// new workspace.
+void EnergyFunctional::getImuHessian(SolverWorkspace &ws, CalibHessian *HCalib,
                                      bool print) {
+  ws.reserve(nFrames);
+  ws.J_cst.clear();
+  ws.cdim = 0;
+  ws.is_spline_valid.assign(nFrames, false);
   if (nFrames == 1)
     return;
 
-  int dim = CPARS + 3 + 29 * nFrames;  //! 4 + 3 + 29 * 8 = 239
-
   if (print) {
     FrameHessian *fh0 = frames[0]->data;
     printf("id: %d ba: %5.2f %5.2f %5.2f bg: %5.2f %5.2f %5.2f\n", fh0->frameID,  //! 这里是keyframe的ID还是？
@@ -472,38 +554,21 @@ void EnergyFunctional::getImuHessian(MatXX &H, VecX &b, MatXX &J_cst,
            fh0->imu_bias[3], fh0->imu_bias[4], fh0->imu_bias[5]);
   }
 
-  // get H and b
-  H = MatXX::Zero(dim, dim);  //! 239 * 239
-  b = VecX::Zero(dim);        //! 239 * 1  
-  std::vector<MatXX> J_cst_vec;
-  std::vector<VecX> r_cst_vec;
-  is_spline_valid = std::vector<bool>(nFrames, false);
-  for (int i = 1; i < nFrames; i++) {
-    bool spline_valid;
-    MatXX J_cst_i;
-    VecX r_cst_i;
-    getImuHessianCurrentFrame(i, HCalib, H, b, spline_valid, J_cst_i, r_cst_i,
-                              print);  //! 计算IMU的H和b  有输出
-    if (spline_valid) {
-      J_cst_vec.push_back(J_cst_i);
-      r_cst_vec.push_back(r_cst_i);
-      is_spline_valid[i] = true;
-    }
-  }
+  // get H and b. frames only write their own buffer, so they are done in
+  // parallel (not when printing) and added in frame order, which keeps the
+  // result independent of the threading.
+  ws.imuFrames.resize(nFrames);
+  if (multiThreading && !print)
+    red->reduce(boost::bind(&EnergyFunctional::getImuHessianFrames, this, &ws,
+                            HCalib, print, _1, _2, _3, _4),
+                1, nFrames, 1);
+  else
+    getImuHessianFrames(&ws, HCalib, print, 1, nFrames, 0, 0);  //! 计算IMU的H和b  有输出
 
-  // concatenate constraints
-  int dim_cst = 0;
-  for (const VecX &r_cst_i : r_cst_vec) {
-    dim_cst += r_cst_i.size();
-  }
-  J_cst = MatXX::Zero(dim_cst, dim);
-  r_cst = VecX::Zero(dim_cst);
-  int cur_idx = 0;
-  for (int i = 0; i < r_cst_vec.size(); i++) {
-    int step = r_cst_vec[i].size();
-    J_cst.block(cur_idx, 0, step, dim) = J_cst_vec[i];
-    r_cst.segment(cur_idx, step) = r_cst_vec[i];
-    cur_idx += step;
+  for (int i = 1; i < nFrames; i++) {
+    addImuFrameHessian(i, ws.imuFrames[i], ws.H, ws.b, &ws.J_cst, &ws.r_cst,
+                       &ws.cdim);
+    ws.is_spline_valid[i] = ws.imuFrames[i].spline_valid;
   }
 
   if (print) {
@@ -769,15 +834,14 @@ void EnergyFunctional::marginalizeFrame(EFFrame *fh, CalibHessian *HCalib) {
     int dim = CPARS + 3 + 29 * nFrames;
     MatXX HM_change = MatXX::Zero(dim, dim);
     VecX bM_change = VecX::Zero(dim);
-    MatXX J_cst;
-    VecX r_cst;
+    ImuFrameHessian imu_frame;
     VecX delta = getStitchedDeltaF();
     VecX delta2 = VecX::Zero(dim);
     delta2.head(CPARS) = delta.head(CPARS);
     delta2.segment<3>(CPARS) = HCalib->sg - HCalib->sg_zero;
     // connection from fh->idx to fh->idx+1
-    getImuHessianCurrentFrame(fh->idx + 1, HCalib, HM_change, bM_change,
-                              spline_valid, J_cst, r_cst, false);
+    getImuHessianCurrentFrame(fh->idx + 1, HCalib, imu_frame, false);
+    addImuFrameHessian(fh->idx + 1, imu_frame, HM_change, bM_change);
     delta2.segment<8>(CPARS + 3 + 29 * (fh->idx + 1)) =
         delta.segment<8>(CPARS + 8 * (fh->idx + 1));
     if (HCalib->scale_trapped) {
@@ -788,8 +852,9 @@ void EnergyFunctional::marginalizeFrame(EFFrame *fh, CalibHessian *HCalib) {
 
     if (fh->idx > 0) {
       // connection from fh->idx-1 to fh->idx
-      getImuHessianCurrentFrame(fh->idx, HCalib, HM_change, bM_change,
-                                spline_valid, J_cst, r_cst, false);
+      getImuHessianCurrentFrame(fh->idx, HCalib, imu_frame, false);
+      addImuFrameHessian(fh->idx, imu_frame, HM_change, bM_change);
+      spline_valid = imu_frame.spline_valid;
       delta2.segment<8>(CPARS + 3 + 29 * (fh->idx - 1)) =
           delta.segment<8>(CPARS + 8 * (fh->idx - 1));
       if (HCalib->scale_trapped) {
@@ -929,33 +994,57 @@ void EnergyFunctional::marginalizePointsF() {
     }
   }
 
-  accSSE_bot->setZero(nFrames);
-  accSSE_top_A->setZero(nFrames);
-  for (EFPoint *p : allPointsToMarg) {
-    accSSE_top_A->addPoint<2>(p, this);
-    accSSE_bot->addPoint(p, false);
-    removePoint(p);
+  accSSE_top_A->setActivePairs(this);
+  if (multiThreading) {
+    red->reduce(boost::bind(&AccumulatedSCHessianSSE::setZero, accSSE_bot,
+                            nFrames, _1, _2, _3, _4),
+                0, 0, 0);
+    red->reduce(boost::bind(&AccumulatedTopHessianSSE::setZero, accSSE_top_A,
+                            nFrames, _1, _2, _3, _4),
+                0, 0, 0);
+    red->reduce(boost::bind(&EnergyFunctional::marginalizePointsFPt, this, _1,
+                            _2, _3, _4),
+                0, allPointsToMarg.size(), 50);
+  } else {
+    accSSE_bot->setZero(nFrames);
+    accSSE_top_A->setZero(nFrames);
+    marginalizePointsFPt(0, allPointsToMarg.size(), 0, 0);
   }
+  for (EFPoint *p : allPointsToMarg)
+    removePoint(p);
+
   MatXX M, Msc;
   VecX Mb, Mbsc;
-  accSSE_top_A->stitchDouble(M, Mb, this, false, false);
-  accSSE_bot->stitchDouble(Msc, Mbsc, this);
+  accSSE_top_A->stitchDoubleMT(red, M, Mb, this, false, multiThreading);
+  accSSE_bot->stitchDoubleMT(red, Msc, Mbsc, this, multiThreading);
 
   resInM += accSSE_top_A->nres[0];
 
-  MatXX H = M - Msc;
-  VecX b = Mb - Mbsc;
-
   if (setting_enable_imu) {
-    expandHbtoFitImu(H, b);
+    expandHbtoFitImu(M, Mb, setting_margWeightFac, setting_margWeightFac, HM,
+                     bM);
+    expandHbtoFitImu(Msc, Mbsc, -setting_margWeightFac, -setting_margWeightFac,
+                     HM, bM);
+  } else {
+    HM += setting_margWeightFac * (M - Msc);
+    bM += setting_margWeightFac * (Mb - Mbsc);
   }
-  HM += setting_margWeightFac * H;
-  bM += setting_margWeightFac * b;
 
   EFIndicesValid = false;
   makeIDX();
 }
 
+// top and bottom (schur) part of the points to marginalize. each point goes
+// through both on the same thread, the schur part needs its Hdd_accLF.
+void EnergyFunctional::marginalizePointsFPt(int min, int max, Vec10 *stats,
+                                            int tid) {
+  for (int i = min; i < max; i++) {
+    EFPoint *p = allPointsToMarg[i];
+    accSSE_top_A->addPoint<2>(p, this, tid);
+    accSSE_bot->addPoint(p, false, tid);
+  }
+}
+
 void EnergyFunctional::dropPointsF() {
 
   for (EFFrame *f : frames) {
@@ -1055,37 +1144,35 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda,
   assert(EFAdjointsValid);
   assert(EFIndicesValid);
 //! [ ***step 1*** ] 先计算正规方程, 涉及边缘化, 先验, 舒尔补等
-  MatXX HL_top, HA_top, H_sc;  
-  VecX bL_top, bA_top, bM_top, b_sc;
+  // everything is put together in ws, nothing of size dim^2 is allocated
+  // unless the window grows.
     //* 针对新的残差, 使用的当前残差, 没有逆深度的部分
-  accumulateAF_MT(HA_top, bA_top, multiThreading);  // 可以参考一点点https://blog.csdn.net/jillar/article/details/123118154
+  accumulateAF_MT(ws.HA, ws.bA, multiThreading);  // 可以参考一点点https://blog.csdn.net/jillar/article/details/123118154
 
-  accumulateLF_MT(HL_top, bL_top, multiThreading);
+  accumulateLF_MT(ws.HL, ws.bL, multiThreading);
     //* 关于逆深度的Schur部分
-  accumulateSCF_MT(H_sc, b_sc, multiThreading);
+  accumulateSCF_MT(ws.Hsc, ws.bsc, multiThreading);
 
-  MatXX HFinal_top = HL_top + HA_top;
-  VecX bFinal_top = bL_top + bA_top;
-
-  // VecX eigenvalues = HFinal_top.eigenvalues().real();
-  // std::sort(eigenvalues.data(), eigenvalues.data() + eigenvalues.size());
-  // std::cout << "dso " << eigenvalues.transpose() << std::endl;
-
-  MatXX J_cst;
-  VecX r_cst;
-  std::vector<bool> is_spline_valid;
   bool imu_valid = setting_enable_imu && HCalib->imu_initialized;
   int dim = imu_valid ? CPARS + 3 + 29 * nFrames : 8 * nFrames + CPARS;
-  if (imu_valid) {  //! 如果开启了IMU 更新H和b HFinal_top  bFinal_top
+  ws.reserve(nFrames);
+  auto H = ws.H.topLeftCorner(dim, dim);
+  auto b = ws.b.head(dim);
+  H.setZero();
+  b.setZero();
+  ws.J_cst.clear();
+  ws.cdim = 0;
+
+  if (imu_valid) {  //! 如果开启了IMU 更新H和b
     //! ************************* get imu H b *****************************/
-    MatXX H_imu;
-    VecX b_imu;
-    getImuHessian(H_imu, b_imu, J_cst, r_cst, HCalib, is_spline_valid, false);
+    getImuHessian(ws, HCalib, false);
 
     //! ************************* add dso H b *****************************/
-    expandHbtoFitImu(HFinal_top, bFinal_top);
-    HFinal_top += H_imu;  //! 在原来top的基础上加上imu的信息
-    bFinal_top += b_imu;
+    expandHbtoFitImu(ws.HA, ws.bA, 1, 1, ws.H, ws.b);
+    expandHbtoFitImu(ws.HL, ws.bL, 1, 1, ws.H, ws.b);
+  } else {
+    H += ws.HA + ws.HL;
+    b += ws.bA + ws.bL;
   }
 
   /******************** add marginalized H b *************************/
@@ -1104,93 +1191,121 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda,
       }
       delta = delta2.eval();
     }
-    bM_top = (bM + HM * delta);
-    HFinal_top += HM;
-    bFinal_top += bM_top;
+    b += bM;
+    b.noalias() += HM * delta;
+    H += HM;
   } // else: when imu is not initialized, marginalization shouldn't start
 
   /************************** add SC H b *******************************/
+  H.diagonal() *= (1 + lambda);
   if (imu_valid) {
-    expandHbtoFitImu(H_sc, b_sc);  //! 还是看不懂。。。
+    expandHbtoFitImu(ws.Hsc, ws.bsc, -1.0f / (1 + lambda), -1, ws.H, ws.b);
+  } else {
+    H -= ws.Hsc * (1.0f / (1 + lambda));  //! 这都是干啥呢
+    b -= ws.bsc;
   }
-  for (int i = 0; i < dim; i++)
-    HFinal_top(i, i) *= (1 + lambda);
-  HFinal_top -= H_sc * (1.0f / (1 + lambda));  //! 这都是干啥呢
-  bFinal_top -= b_sc;
 
+  /************ reduced system, constraints, scaling ******************/
+  // kept are calib, scale (and gravity once the scale is trapped), and per
+  // frame pose, affine and bias, plus the spline if it is constrained. the
+  // constraint rows follow. without imu all of H is kept.
+  ws.keep.clear();
+  ws.reducedIdx.assign(dim, -1);
   if (imu_valid) {
-    /********************* add constraint J r **************************/
-    int cdim = r_cst.size();
-    HFinal_top.conservativeResize(dim + cdim, dim + cdim);
-    HFinal_top.block(0, dim, dim, cdim) = J_cst.transpose();
-    HFinal_top.block(dim, 0, cdim, dim) = J_cst;
-    HFinal_top.bottomRightCorner(cdim, cdim).setZero();
-    bFinal_top.conservativeResize(dim + cdim);
-    bFinal_top.tail(cdim) = r_cst;
-    dim += cdim;
-
-    /*************** remove unconstraint imu items *********************/
-    int vi = CPARS + 1;
-    if (HCalib->scale_trapped) {
-      vi += 2;
-    }
+    int nsg = HCalib->scale_trapped ? 3 : 1;
+    for (int i = 0; i < CPARS + nsg; i++)
+      ws.keep.push_back(i);
     for (int i = 0; i < nFrames; i++) {
       int fi = CPARS + 3 + 29 * i;
-      int vs = is_spline_valid[i] ? 29 : 14;
-      HFinal_top.block(0, vi, dim, vs) =
-          HFinal_top.block(0, fi, dim, vs).eval();
-      HFinal_top.block(vi, 0, vs, dim) =
-          HFinal_top.block(fi, 0, vs, dim).eval();
-      bFinal_top.segment(vi, vs) = bFinal_top.segment(fi, vs).eval();
-      vi += vs;
+      int vs = ws.is_spline_valid[i] ? 29 : 14;
+      for (int j = 0; j < vs; j++)
+        ws.keep.push_back(fi + j);
     }
-    int fi = CPARS + 3 + 29 * nFrames;
-    HFinal_top.block(0, vi, dim, cdim) =
-        HFinal_top.block(0, fi, dim, cdim).eval();
-    HFinal_top.block(vi, 0, cdim, dim) =
-        HFinal_top.block(fi, 0, cdim, dim).eval();
-    bFinal_top.segment(vi, cdim) = bFinal_top.segment(fi, cdim).eval();
-    HFinal_top = HFinal_top.topLeftCorner(vi + cdim, vi + cdim).eval();
-    bFinal_top = bFinal_top.head(vi + cdim).eval();
-
-    // eigenvalues = HFinal_top.topLeftCorner(vi, vi).eigenvalues().real();
-    // std::sort(eigenvalues.data(), eigenvalues.data() + eigenvalues.size());
-    // std::cout << "imu " << eigenvalues.transpose() << std::endl << std::endl;
-    // if (HCalib->scale_trapped) {
-    //   exit(1);
-    // }
+  } else {
+    for (int i = 0; i < dim; i++)
+      ws.keep.push_back(i);
+  }
+  int nk = ws.keep.size();
+  int cdim = ws.cdim;
+  int n = nk + cdim;
+  for (int i = 0; i < nk; i++)
+    ws.reducedIdx[ws.keep[i]] = i;
+
+  // scaling as 1 / sqrt(diag + 10), the constraint rows have a zero diagonal.
+  for (int i = 0; i < nk; i++)
+    ws.S[i] = 1 / sqrt(H(ws.keep[i], ws.keep[i]) + 10);
+  ws.S.segment(nk, cdim).setConstant(1 / sqrt(10.0));
+
+  auto K = ws.K.topLeftCorner(n, n);
+  for (int c = 0; c < nk; c++) {
+    const double *Hcol = &ws.H(0, ws.keep[c]);
+    double *Kcol = &ws.K(0, c);
+    for (int r = 0; r < nk; r++)
+      Kcol[r] = ws.S[r] * Hcol[ws.keep[r]] * ws.S[c];
+    ws.K.block(nk, c, cdim, 1).setZero();
+  }
+  K.rightCols(cdim).setZero();
+  for (const Eigen::Triplet<double> &t : ws.J_cst) {
+    int c = ws.reducedIdx[t.col()];
+    if (c < 0)
+      continue;
+    int r = nk + t.row();
+    double v = ws.S[r] * t.value() * ws.S[c];
+    ws.K(r, c) += v;
+    ws.K(c, r) += v;
   }
+  for (int i = 0; i < nk; i++)
+    ws.k[i] = ws.S[i] * b[ws.keep[i]];
+  ws.k.segment(nk, cdim) =
+      ws.S.segment(nk, cdim).cwiseProduct(ws.r_cst.head(cdim));
 
   //! ************************ solve system *****************************/
-  VecX SVecI = (HFinal_top.diagonal() + VecX::Constant(HFinal_top.cols(), 10))
-                   .cwiseSqrt()
-                   .cwiseInverse();
-  MatXX HFinalScaled = SVecI.asDiagonal() * HFinal_top * SVecI.asDiagonal();
-  VecX x = SVecI.asDiagonal() * 
-           HFinalScaled.ldlt().solve(SVecI.asDiagonal() * bFinal_top);  //! 使用LDLT分解求解线性方程组
-
+  auto solve_start = std::chrono::steady_clock::now();
+  // the other solvers fall back to the dense LDLT if they fail.
+  bool solved = false;
+  if (imu_valid && setting_solverMode == SOLVER_KKT_SPARSE)
+    solved = kktSolver->solve(K, ws.k.head(n), cdim, ws.x);
+  else if (imu_valid && setting_solverMode == SOLVER_KKT_SCHUR)
+    solved = solveKKTSchur(nk, cdim);
+  if (!solved) {
+    ws.ldlt.compute(K);
+    ws.x = ws.ldlt.solve(ws.k.head(n));  //! 使用LDLT分解求解线性方程组
+  }
+  statistics_solveMs += std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - solve_start)
+                            .count();
+  statistics_numSolves++;
+  double residual = (K.selfadjointView<Eigen::Lower>() * ws.x -
+                     ws.k.head(n)).norm() /
+                    std::max(1e-30, ws.k.head(n).norm());
+  statistics_solveResidual += residual;
+  statistics_maxSolveResidual = std::max(statistics_maxSolveResidual, residual);
+  ws.x.array() *= ws.S.head(n).array();
+  VecX x;
   if (imu_valid) {
-    VecX x_dso = VecX::Zero(CPARS + 8 * nFrames);
-    x_dso.head(CPARS) = x.head(CPARS);
+    const VecX &x_imu = ws.x;
+    x = VecX::Zero(CPARS + 8 * nFrames);
+    x.head(CPARS) = x_imu.head(CPARS);
     HCalib->sg_step.setZero();
-    HCalib->sg_step[0] = -x(CPARS);  //! 应该是这里保存了step
+    HCalib->sg_step[0] = -x_imu(CPARS);  //! 应该是这里保存了step
     int vi = CPARS + 1;
     if (HCalib->scale_trapped) {
-      HCalib->sg_step.tail(2) = -x.segment<2>(CPARS + 1);
+      HCalib->sg_step.tail(2) = -x_imu.segment<2>(CPARS + 1);
       vi += 2;
     }
     for (int i = 0; i < nFrames; i++) {
-      x_dso.segment<8>(CPARS + i * 8) = x.segment<8>(vi);
+      x.segment<8>(CPARS + i * 8) = x_imu.segment<8>(vi);
       vi += 8;
       frames[i]->data->step_imu.setZero();
-      frames[i]->data->step_imu.head(6) = -x.segment<6>(vi);
+      frames[i]->data->step_imu.head(6) = -x_imu.segment<6>(vi);
       vi += 6;
-      if (is_spline_valid[i]) {
-        frames[i]->data->step_imu.tail(15) = -x.segment<15>(vi);
+      if (ws.is_spline_valid[i]) {
+        frames[i]->data->step_imu.tail(15) = -x_imu.segment<15>(vi);
         vi += 15;
       }
     }
-    x = x_dso.eval();  // 这里是干啥
+  } else {
+    x = ws.x;
   }
 
   // if (iteration >= 2) {
@@ -1206,6 +1321,53 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda,
   currentLambda = 0;
 }
 
+// range space method: with H the kept part of the scaled system and J the
+// constraint rows, H x + J^T mu = b, J x = r is solved as
+// (J H^-1 J^T) mu = J H^-1 b - r and x = H^-1 (b - J^T mu). both are cholesky
+// solves of positive definite matrices, instead of an LDLT of the indefinite
+// KKT matrix. writes x, mu to ws.x like the KKT solve, false if a cholesky
+// fails.
+bool EnergyFunctional::solveKKTSchur(int nk, int cdim) {
+  auto H = ws.K.topLeftCorner(nk, nk);
+  auto J = ws.K.block(nk, 0, cdim, nk);
+
+  ws.llt.compute(H);
+  if (ws.llt.info() != Eigen::Success)
+    return false;
+
+  ws.x.resize(nk + cdim);
+  auto x = ws.x.head(nk);
+  auto mu = ws.x.tail(cdim);
+  x = ws.k.head(nk);
+  ws.llt.solveInPlace(x);
+
+  if (cdim > 0) {
+    ws.HinvJt = J.transpose();
+    ws.llt.solveInPlace(ws.HinvJt);
+    ws.Scst.noalias() = J * ws.HinvJt;
+    ws.cstLlt.compute(ws.Scst);
+    if (ws.cstLlt.info() != Eigen::Success)
+      return false;
+
+    mu = ws.k.segment(nk, cdim);
+    mu.noalias() -= J * x;
+    mu = -mu;
+    ws.cstLlt.solveInPlace(mu);
+    x.noalias() -= ws.HinvJt * mu;
+  }
+  return ws.x.allFinite();
+}
+
+void EnergyFunctional::printSolverStats() const {
+  printf("Solve tt: %.3f ms, relative residual %.1e (max %.1e) (solver mode "
+         "%d)\n",
+         statistics_solveMs / std::max(1, statistics_numSolves),
+         statistics_solveResidual / std::max(1, statistics_numSolves),
+         statistics_maxSolveResidual, setting_solverMode);
+  if (setting_solverMode == SOLVER_KKT_SPARSE)
+    kktSolver->printStats();
+}
+
 void EnergyFunctional::makeIDX() {
   for (unsigned int idx = 0; idx < frames.size(); idx++)
     frames[idx]->idx = idx;
@@ -27,6 +27,8 @@
 #include "util/IndexThreadReduce.h"
 #include "util/NumType.h"
 #include "vector"
+#include <Eigen/Cholesky>
+#include <Eigen/SparseCore>
 #include <math.h>
 
 namespace dso {
@@ -44,6 +46,67 @@ class AccumulatedTopHessian;
 class AccumulatedTopHessianSSE;         
 class AccumulatedSCHessian;             
 class AccumulatedSCHessianSSE;
+class SparseKKTSolver;
+
+// imu terms between frame fi - 1 and fi (bias random walk, spline residuals
+// and constraints), before they are added into the system.
+struct ImuFrameHessian {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+  Mat66 Hbias;
+  Vec6 bbias;
+
+  // spline part, only set if spline_valid.
+  bool spline_valid;
+  Mat33 Hss;                        // scale / gravity.
+  Eigen::Matrix<double, 29, 3> Hfs; // frame fi - scale / gravity.
+  Eigen::Matrix<double, 29, 29> Hff;
+  Vec3 bs;
+  Eigen::Matrix<double, 29, 1> bf;
+
+  // constraints, rows from 0 to ncst, cols in the imu layout.
+  int ncst;
+  Vec6 r_cst;
+  std::vector<Eigen::Triplet<double>> J_cst;
+};
+
+// buffers of solveSystemF, kept between iterations. they are reserved for the
+// largest window, so an iteration only writes into them; matrices are used
+// through their top left corner.
+struct SolverWorkspace {
+  // accumulated dso parts (CPARS + 8 * nFrames).
+  MatXX HA, HL, Hsc;
+  VecX bA, bL, bsc;
+
+  // full system in the imu layout (CPARS + 3 + 29 * nFrames).
+  MatXX H;
+  VecX b;
+
+  // spline constraints: jacobian as (row, imu layout col, value), residual.
+  std::vector<Eigen::Triplet<double>> J_cst;
+  VecX r_cst;
+  int cdim;
+  std::vector<bool> is_spline_valid;
+  std::vector<ImuFrameHessian, Eigen::aligned_allocator<ImuFrameHessian>>
+      imuFrames;
+
+  // reduced, scaled KKT system: kept columns of H, then the constraints.
+  std::vector<int> keep;       // reduced index -> imu layout index.
+  std::vector<int> reducedIdx; // imu layout index -> reduced index or -1.
+  MatXX K;
+  VecX k;
+  VecX S; // scaling.
+  VecX x;
+  Eigen::LDLT<MatXX> ldlt;
+
+  // SOLVER_KKT_SCHUR: cholesky of the kept part, H^-1 J^T and J H^-1 J^T.
+  Eigen::LLT<MatXX> llt;
+  Eigen::LLT<MatXX> cstLlt;
+  MatXX HinvJt;
+  MatXX Scst;
+
+  SolverWorkspace() : cdim(0) {}
+  void reserve(int nFrames);
+};
 
 extern bool EFAdjointsValid;
 extern bool EFIndicesValid;
@@ -100,9 +163,16 @@ public:
            Eigen::aligned_allocator<std::pair<const uint64_t, Eigen::Vector2i>>>
       connectivityMap;
 
+  // time spent solving the final system in solveSystemF, and the relative
+  // residual |K x - k| / |k| of the scaled system.
+  double statistics_solveMs;
+  int statistics_numSolves;
+  double statistics_solveResidual;
+  double statistics_maxSolveResidual;
+  void printSolverStats() const;
+
   // ToDo: move to private
-  void getImuHessian(MatXX &H, VecX &b, MatXX &J_cst, VecX &r_cst,
-                     CalibHessian *HCalib, std::vector<bool> &is_spline_valid,
+  void getImuHessian(SolverWorkspace &ws, CalibHessian *HCalib,
                      bool print = false);
 
 private:
@@ -116,13 +186,22 @@ private:
   void accumulateLF_MT(MatXX &H, VecX &b, bool MT);
   void accumulateSCF_MT(MatXX &H, VecX &b, bool MT);
 
-  void expandHbtoFitImu(MatXX &H, VecX &b);
+  bool solveKKTSchur(int nk, int cdim);
 
-  void getImuHessianCurrentFrame(int fi, CalibHessian *HCalib, MatXX &H,
-                                 VecX &b, bool &spline_valid, MatXX &J_vr,
-                                 VecX &r_vr, bool print);
+  void expandHbtoFitImu(const MatXX &H, const VecX &b, double Hfac,
+                        double bfac, MatXX &He, VecX &be);
+
+  void getImuHessianCurrentFrame(int fi, CalibHessian *HCalib,
+                                 ImuFrameHessian &f, bool print);
+  void getImuHessianFrames(SolverWorkspace *ws, CalibHessian *HCalib,
+                           bool print, int min, int max, Vec10 *stats,
+                           int tid);
+  void addImuFrameHessian(int fi, const ImuFrameHessian &f, MatXX &H, VecX &b,
+                          std::vector<Eigen::Triplet<double>> *J_cst = 0,
+                          VecX *r_cst = 0, int *cdim = 0);
 
   void calcLEnergyPt(int min, int max, Vec10 *stats, int tid);
+  void marginalizePointsFPt(int min, int max, Vec10 *stats, int tid);
 
   void orthogonalize(VecX *b, MatXX *H);
   Mat18f *adHTdeltaF;
@@ -151,6 +230,9 @@ private:
 
   AccumulatedSCHessianSSE *accSSE_bot;
 
+  SparseKKTSolver *kktSolver;
+  SolverWorkspace ws;
+
   std::vector<EFPoint *> allPoints;
   std::vector<EFPoint *> allPointsToMarg;
 
@@ -28,8 +28,29 @@
 #include "SSE2NEON.h"
 #endif
 
+// 8-wide AVX2/FMA paths, compiled for that target independent of -march and
+// only taken if the cpu running the binary supports them.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSO_AVX_DISPATCH 1
+#include <immintrin.h>
+#define DSO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define DSO_AVX_DISPATCH 0
+#define DSO_TARGET_AVX2
+#endif
+
 namespace dso {
 
+inline bool cpuHasAVX2FMA() {
+#if DSO_AVX_DISPATCH
+  static const bool has =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return has;
+#else
+  return false;
+#endif
+}
+
 template <int i, int j> class AccumulatorXX {
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
@@ -1183,6 +1204,7 @@ public:
     memset(SSEData, 0, sizeof(float) * 4 * 45);
     memset(SSEData1k, 0, sizeof(float) * 4 * 45);
     memset(SSEData1m, 0, sizeof(float) * 4 * 45);
+    memset(AVXData, 0, sizeof(float) * (8 * 45 + 4));
     num = numIn1 = numIn1k = numIn1m = 0;
   }
 
@@ -1431,6 +1453,135 @@ public:
     shiftUp(false);
   }
 
+  /*
+   * updateSSE_eighted for 8 terms at once: J holds the 9 jacobian rows of 8
+   * lanes each (J[8 * k + lane]), w the 8 weights. sums go to an 8-wide
+   * buffer that shiftUp folds into the 4-wide one, so the 1k / 1m buffering
+   * per lane is the same as for the SSE path. only call if cpuHasAVX2FMA().
+   */
+  DSO_TARGET_AVX2 void updateAVX_eighted(const float *const J,
+                                         const float *const w) {
+#if DSO_AVX_DISPATCH
+    __m256 Jk[9];
+    for (int k = 0; k < 9; k++)
+      Jk[k] = _mm256_loadu_ps(J + 8 * k);
+    __m256 w8 = _mm256_loadu_ps(w);
+
+    float *pt = avxData();
+
+    __m256 J0w = _mm256_mul_ps(Jk[0], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[0], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[1], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[2], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[3], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[4], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[5], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J0w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J1w = _mm256_mul_ps(Jk[1], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[1], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[2], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[3], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[4], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[5], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J1w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J2w = _mm256_mul_ps(Jk[2], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[2], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[3], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[4], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[5], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J2w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J3w = _mm256_mul_ps(Jk[3], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J3w, Jk[3], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J3w, Jk[4], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J3w, Jk[5], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J3w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J3w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J3w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J4w = _mm256_mul_ps(Jk[4], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J4w, Jk[4], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J4w, Jk[5], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J4w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J4w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J4w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J5w = _mm256_mul_ps(Jk[5], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J5w, Jk[5], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J5w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J5w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J5w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J6w = _mm256_mul_ps(Jk[6], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J6w, Jk[6], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J6w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J6w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J7w = _mm256_mul_ps(Jk[7], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J7w, Jk[7], _mm256_load_ps(pt)));
+    pt += 8;
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J7w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+
+    __m256 J8w = _mm256_mul_ps(Jk[8], w8);
+    _mm256_store_ps(pt, _mm256_fmadd_ps(J8w, Jk[8], _mm256_load_ps(pt)));
+    pt += 8;
+    num += 8;
+    numIn1++;
+    shiftUp(false);
+#endif
+  }
+
   inline void updateSingle(const float J0, const float J1, const float J2,
                            const float J3, const float J4, const float J5,
                            const float J6, const float J7, const float J8,
@@ -1661,17 +1812,27 @@ private:
   EIGEN_ALIGN16 float SSEData[4 * 45];
   EIGEN_ALIGN16 float SSEData1k[4 * 45];
   EIGEN_ALIGN16 float SSEData1m[4 * 45];
+  // heap objects are only 16-aligned, the 8-wide buffer is aligned by hand.
+  EIGEN_ALIGN16 float AVXData[8 * 45 + 4];
+  inline float *avxData() {
+    return (float *)(((size_t)AVXData + 31) & ~(size_t)31);
+  }
   float numIn1, numIn1k, numIn1m;
 
   void shiftUp(bool force) {
     if (numIn1 > 1000 || force) {
+      const float *avx = avxData();
       for (int i = 0; i < 45; i++)
-        _mm_store_ps(SSEData1k + 4 * i,
-                     _mm_add_ps(_mm_load_ps(SSEData + 4 * i),
-                                _mm_load_ps(SSEData1k + 4 * i)));
+        _mm_store_ps(
+            SSEData1k + 4 * i,
+            _mm_add_ps(_mm_add_ps(_mm_load_ps(SSEData + 4 * i),
+                                  _mm_add_ps(_mm_load_ps(avx + 8 * i),
+                                             _mm_load_ps(avx + 8 * i + 4))),
+                       _mm_load_ps(SSEData1k + 4 * i)));
       numIn1k += numIn1;
       numIn1 = 0;
       memset(SSEData, 0, sizeof(float) * 4 * 45);
+      memset(AVXData, 0, sizeof(float) * (8 * 45 + 4));
     }
 
     if (numIn1k > 1000 || force) {
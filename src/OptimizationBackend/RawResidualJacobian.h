@@ -24,10 +24,11 @@
 #pragma once
 
 #include "util/NumType.h"
+#include "util/ObjectPool.h"
 
 namespace dso {
 struct RawResidualJacobian {            //!< 总领全局 协调各方
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+  DSO_POOLED_OPERATOR_NEW(RawResidualJacobian);
   // ================== new structure: save independently =============.
   VecNRf resF;   //8*1                  //!< 每个patch的8个残差  MAX_RES_PER_POINT=8  Matrix<float, MAX_RES_PER_POINT, 1>
 
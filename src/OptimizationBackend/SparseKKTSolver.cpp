@@ -0,0 +1,120 @@
+/**
+ * This file is part of DSO.
+ *
+ * Copyright 2016 Technical University of Munich and Intel.
+ * Developed by Jakob Engel <engelj at in dot tum dot de>,
+ * for more information see <http://vision.in.tum.de/dso>.
+ * If you use this code, please cite the respective publications as
+ * listed on the above website.
+ *
+ * DSO is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DSO is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DSO. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SparseKKTSolver.h"
+#include <algorithm>
+#include <stdio.h>
+
+namespace dso {
+
+SparseKKTSolver::SparseKKTSolver()
+    : numSolves(0), numAnalyzed(0), numFailed(0), patternConstraints(-1) {}
+
+void SparseKKTSolver::buildLower(const Eigen::Ref<const MatXX> &H) {
+  int n = H.cols();
+  lower.resize(n, n);
+  lower.reserve(patternInner.size());
+  for (int j = 0; j < n; j++) {
+    lower.startVec(j);
+    const double *col = H.data() + (size_t)j * H.outerStride();
+    for (int i = j; i < n; i++)
+      if (col[i] != 0)
+        lower.insertBack(i, j) = col[i];
+  }
+  lower.finalize();
+}
+
+bool SparseKKTSolver::samePattern() const {
+  int n = lower.cols();
+  if ((int)patternOuter.size() != n + 1 ||
+      (int)patternInner.size() != lower.nonZeros())
+    return false;
+  return std::equal(patternOuter.begin(), patternOuter.end(),
+                    lower.outerIndexPtr()) &&
+         std::equal(patternInner.begin(), patternInner.end(),
+                    lower.innerIndexPtr());
+}
+
+void SparseKKTSolver::analyze(int numConstraints) {
+  int n = lower.cols();
+  int firstConstraint = n - numConstraints;
+
+  // elimination order from AMD, then the constraints are moved behind
+  // everything else, keeping their relative order.
+  Perm amdOrder;
+  Eigen::AMDOrdering<int> amd;
+  amd(lower.selfadjointView<Eigen::Lower>(), amdOrder);
+  perm.resize(n);
+  int k = 0;
+  for (int i = 0; i < n; i++)
+    if (amdOrder.indices()[i] < firstConstraint)
+      perm.indices()[amdOrder.indices()[i]] = k++;
+  for (int i = 0; i < n; i++)
+    if (amdOrder.indices()[i] >= firstConstraint)
+      perm.indices()[amdOrder.indices()[i]] = k++;
+
+  patternOuter.assign(lower.outerIndexPtr(), lower.outerIndexPtr() + n + 1);
+  patternInner.assign(lower.innerIndexPtr(),
+                      lower.innerIndexPtr() + lower.nonZeros());
+  patternConstraints = numConstraints;
+
+  permuted.resize(n, n);
+  permuted.selfadjointView<Eigen::Lower>() =
+      lower.selfadjointView<Eigen::Lower>().twistedBy(perm);
+  ldlt.analyzePattern(permuted);
+  numAnalyzed++;
+}
+
+bool SparseKKTSolver::solve(const Eigen::Ref<const MatXX> &H,
+                            const Eigen::Ref<const VecX> &b,
+                            int numConstraints, VecX &x) {
+  buildLower(H);
+
+  if (numConstraints != patternConstraints || !samePattern())
+    analyze(numConstraints);
+  else
+    permuted.selfadjointView<Eigen::Lower>() =
+        lower.selfadjointView<Eigen::Lower>().twistedBy(perm);
+
+  ldlt.factorize(permuted);
+  if (ldlt.info() != Eigen::Success) {
+    numFailed++;
+    return false;
+  }
+
+  VecX xp = ldlt.solve(perm * b);
+  if (!xp.allFinite()) {
+    numFailed++;
+    return false;
+  }
+  x = perm.transpose() * xp;
+  numSolves++;
+  return true;
+}
+
+void SparseKKTSolver::printStats() const {
+  printf("Sparse KKT: %d solves, %d with new ordering, %d failed\n", numSolves,
+         numAnalyzed, numFailed);
+}
+
+} // namespace dso
@@ -0,0 +1,77 @@
+/**
+ * This file is part of DSO.
+ *
+ * Copyright 2016 Technical University of Munich and Intel.
+ * Developed by Jakob Engel <engelj at in dot tum dot de>,
+ * for more information see <http://vision.in.tum.de/dso>.
+ * If you use this code, please cite the respective publications as
+ * listed on the above website.
+ *
+ * DSO is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DSO is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DSO. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "util/NumType.h"
+#include "vector"
+#include <Eigen/OrderingMethods>
+#include <Eigen/SparseCholesky>
+
+namespace dso {
+
+// sparse LDLT for the imu KKT system of solveSystemF. the imu states of a
+// frame are only coupled to the neighbouring frames, so only the visual part
+// (8 per frame) and the border (calib, scale, gravity) are dense.
+// the fill reducing ordering and the symbolic factorization are kept as long
+// as the sparsity pattern does not change, across iterations and keyframes.
+class SparseKKTSolver {
+public:
+  SparseKKTSolver();
+
+  // solves H x = b. H is symmetric, its last numConstraints rows / cols are
+  // equality constraints with a zero diagonal block. these are eliminated
+  // last, so H without them has to be positive definite, which means no
+  // pivoting is needed. returns false if the factorization fails, x is not
+  // touched then.
+  bool solve(const Eigen::Ref<const MatXX> &H,
+             const Eigen::Ref<const VecX> &b, int numConstraints, VecX &x);
+
+  void printStats() const;
+
+  int numSolves;   // successful solves.
+  int numAnalyzed; // solves that had to redo ordering and symbolic part.
+  int numFailed;
+
+private:
+  typedef Eigen::SparseMatrix<double, Eigen::ColMajor, int> SpMat;
+  typedef Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> Perm;
+
+  void buildLower(const Eigen::Ref<const MatXX> &H);
+  bool samePattern() const;
+  void analyze(int numConstraints);
+
+  SpMat lower;    // lower triangle of H, original order.
+  SpMat permuted; // lower triangle of P H P^T.
+  Perm perm;
+
+  // pattern of lower the ordering was made for.
+  std::vector<int> patternOuter;
+  std::vector<int> patternInner;
+  int patternConstraints;
+
+  Eigen::SimplicialLDLT<SpMat, Eigen::Lower, Eigen::NaturalOrdering<int>>
+      ldlt;
+};
+
+} // namespace dso
@@ -0,0 +1,162 @@
+/**
+ * This file is part of DSO.
+ *
+ * Copyright 2016 Technical University of Munich and Intel.
+ * Developed by Jakob Engel <engelj at in dot tum dot de>,
+ * for more information see <http://vision.in.tum.de/dso>.
+ * If you use this code, please cite the respective publications as
+ * listed on the above website.
+ *
+ * DSO is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DSO is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DSO. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// drives Accumulator9 with synthetic weighted jacobians through the SSE and
+// the AVX2/FMA path, checks both against a double precision reference and
+// times them. returns non-zero if a check fails.
+
+#include "OptimizationBackend/MatrixAccumulators.h"
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace dso;
+
+typedef std::vector<float, Eigen::aligned_allocator<float>> AlignedFloats;
+
+static const int N = 1 << 16; // terms, enough for several 1k shifts.
+static const int REPS = 200;
+static const double TOL = 1e-4; // relative to the largest entry.
+
+// jacobians in the layout of both paths: J4 in blocks of 9 rows x 4 lanes,
+// J8 in blocks of 9 rows x 8 lanes, same values.
+static AlignedFloats J4(9 * N), J8(9 * N), w(N);
+static Eigen::Matrix<double, 9, 9> Href;
+
+static void makeData() {
+  srand(1);
+  for (int i = 0; i < N; i++) {
+    for (int k = 0; k < 9; k++) {
+      float v = (rand() / (float)RAND_MAX - 0.5f) * 10;
+      J4[(i / 4) * 36 + k * 4 + i % 4] = v;
+      J8[(i / 8) * 72 + k * 8 + i % 8] = v;
+    }
+    w[i] = rand() / (float)RAND_MAX;
+  }
+
+  Href.setZero();
+  for (int i = 0; i < N; i++) {
+    Eigen::Matrix<double, 9, 1> J;
+    for (int k = 0; k < 9; k++)
+      J[k] = J4[(i / 4) * 36 + k * 4 + i % 4];
+    Href += w[i] * J * J.transpose();
+  }
+}
+
+static void updateSSE(Accumulator9 &acc, int i) {
+  const float *c = &J4[9 * i];
+  acc.updateSSE_eighted(_mm_load_ps(c), _mm_load_ps(c + 4),
+                        _mm_load_ps(c + 8), _mm_load_ps(c + 12),
+                        _mm_load_ps(c + 16), _mm_load_ps(c + 20),
+                        _mm_load_ps(c + 24), _mm_load_ps(c + 28),
+                        _mm_load_ps(c + 32), _mm_load_ps(&w[i]));
+}
+
+static void runSSE(Accumulator9 &acc) {
+  acc.initialize();
+  for (int i = 0; i < N; i += 4)
+    updateSSE(acc, i);
+  acc.finish();
+}
+
+static void runAVX(Accumulator9 &acc) {
+  acc.initialize();
+  for (int i = 0; i < N; i += 8)
+    acc.updateAVX_eighted(&J8[9 * i], &w[i]);
+  acc.finish();
+}
+
+// both paths into the same accumulator, so the 8-wide buffer has to be
+// folded into the 4-wide one in between.
+static void runMixed(Accumulator9 &acc) {
+  acc.initialize();
+  for (int i = 0; i < N; i += 8) {
+    if ((i / 8) % 3 == 0) {
+      acc.updateAVX_eighted(&J8[9 * i], &w[i]);
+    } else {
+      updateSSE(acc, i);
+      updateSSE(acc, i + 4);
+    }
+  }
+  acc.finish();
+}
+
+static bool check(const char *name, const Accumulator9 &acc) {
+  double err = (acc.H.cast<double>() - Href).cwiseAbs().maxCoeff() /
+               Href.cwiseAbs().maxCoeff();
+  bool ok = err < TOL && acc.num == (size_t)N;
+  printf("%-22s rel err %.2e, num %zu: %s\n", name, err, acc.num,
+         ok ? "ok" : "FAILED");
+  return ok;
+}
+
+template <typename F> static double timeUs(F run, Accumulator9 &acc) {
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < REPS; r++)
+    run(acc);
+  std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(t1 - t0).count() / REPS;
+}
+
+int main() {
+  makeData();
+  bool ok = true;
+
+  // the 8-wide buffer is aligned by hand inside the object, so place the
+  // accumulator at both 32 and 16 (mod 32) byte offsets.
+  char *mem = (char *)Eigen::internal::aligned_malloc(sizeof(Accumulator9) +
+                                                      32);
+  for (int off = 0; off <= 16; off += 16) {
+    Accumulator9 *acc = new (mem + off) Accumulator9;
+    printf("accumulator at offset %d mod 32\n", off);
+
+    runSSE(*acc);
+    ok &= check("  SSE", *acc);
+
+    if (!cpuHasAVX2FMA()) {
+      printf("  no AVX2/FMA on this cpu, AVX path not checked\n");
+      acc->~Accumulator9();
+      continue;
+    }
+    runAVX(*acc);
+    ok &= check("  AVX2/FMA", *acc);
+    runMixed(*acc);
+    ok &= check("  SSE + AVX2/FMA mixed", *acc);
+    acc->~Accumulator9();
+  }
+
+  Accumulator9 *acc = new (mem) Accumulator9;
+  double tSSE = timeUs(runSSE, *acc);
+  printf("SSE:      %.3f us per 1k terms\n", tSSE / N * 1000);
+  if (cpuHasAVX2FMA()) {
+    double tAVX = timeUs(runAVX, *acc);
+    printf("AVX2/FMA: %.3f us per 1k terms\n", tAVX / N * 1000);
+  }
+  acc->~Accumulator9();
+  Eigen::internal::aligned_free(mem);
+
+  printf("%s\n", ok ? "all checks passed" : "CHECKS FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// Copyright (C) <2020> <Jiawei Mo, Junaed Sattar>
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// This file is modified from <https://github.com/JakobEngel/dso>
+
+// builds the level 1 distance map of CoarseDistanceMap from random seeds with
+// the ring BFS and with the two-pass transform, checks that both maps are
+// exactly equal and times them. returns non-zero if a map differs.
+
+#include "FullSystem/DistanceTransform.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace dso;
+
+static const int REPS = 50;
+
+// seeds as makeDistanceMap creates them: 0 < u < w1, 0 < v < h1.
+static void makeSeeds(int w1, int h1, int numSeeds,
+                      std::vector<Eigen::Vector2i> &seeds) {
+  seeds.resize(numSeeds);
+  for (int i = 0; i < numSeeds; i++)
+    seeds[i] = Eigen::Vector2i(1 + rand() % (w1 - 1), 1 + rand() % (h1 - 1));
+}
+
+static void initMap(int w1, int h1, const std::vector<Eigen::Vector2i> &seeds,
+                    std::vector<float> &map) {
+  map.assign(w1 * h1, 1000);
+  for (size_t i = 0; i < seeds.size(); i++)
+    map[seeds[i][0] + w1 * seeds[i][1]] = 0;
+}
+
+struct Buffers {
+  std::vector<Eigen::Vector2i> list1, list2;
+  std::vector<int> buf;
+  std::vector<float> bfs, twoPass;
+};
+
+static void runBFS(int w1, int h1, const std::vector<Eigen::Vector2i> &seeds,
+                   Buffers &b) {
+  initMap(w1, h1, seeds, b.bfs);
+  Eigen::Vector2i *l1 = b.list1.data(), *l2 = b.list2.data();
+  for (size_t i = 0; i < seeds.size(); i++)
+    l1[i] = seeds[i];
+  growDistBFSRings(b.bfs.data(), l1, l2, seeds.size(), w1, h1);
+}
+
+static void runTwoPass(int w1, int h1,
+                       const std::vector<Eigen::Vector2i> &seeds, Buffers &b) {
+  initMap(w1, h1, seeds, b.twoPass);
+  growDistTwoPass(b.twoPass.data(), b.buf.data(), w1, h1);
+}
+
+int main() {
+  srand(1);
+  bool ok = true;
+
+  // level 1 of 640x480, 752x480 (EuRoC) and 1280x720 images.
+  const int sizes[3][2] = {{320, 240}, {376, 240}, {640, 360}};
+  const int seedCounts[3] = {50, 500, 2000};
+
+  for (int s = 0; s < 3; s++) {
+    int w1 = sizes[s][0], h1 = sizes[s][1];
+    Buffers b;
+    b.list1.resize(w1 * h1);
+    b.list2.resize(w1 * h1);
+    b.buf.resize(w1 * h1);
+
+    for (int c = 0; c < 3; c++) {
+      std::vector<Eigen::Vector2i> seeds;
+
+      // exactness over several random seed sets.
+      int numDiff = 0;
+      for (int t = 0; t < 20; t++) {
+        makeSeeds(w1, h1, seedCounts[c], seeds);
+        runBFS(w1, h1, seeds, b);
+        runTwoPass(w1, h1, seeds, b);
+        for (int i = 0; i < w1 * h1; i++)
+          if (b.bfs[i] != b.twoPass[i])
+            numDiff++;
+      }
+      ok &= numDiff == 0;
+
+      double tBFS = 0, tTwoPass = 0;
+      for (int r = 0; r < REPS; r++) {
+        std::chrono::steady_clock::time_point t0 =
+            std::chrono::steady_clock::now();
+        runBFS(w1, h1, seeds, b);
+        std::chrono::steady_clock::time_point t1 =
+            std::chrono::steady_clock::now();
+        runTwoPass(w1, h1, seeds, b);
+        std::chrono::steady_clock::time_point t2 =
+            std::chrono::steady_clock::now();
+        tBFS += std::chrono::duration<double, std::micro>(t1 - t0).count();
+        tTwoPass += std::chrono::duration<double, std::micro>(t2 - t1).count();
+      }
+
+      printf("%dx%d, %4d seeds: %s, ring BFS %7.1f us, two-pass %7.1f us\n",
+             w1, h1, seedCounts[c], numDiff == 0 ? "equal" : "DIFFERENT",
+             tBFS / REPS, tTwoPass / REPS);
+    }
+  }
+
+  printf("%s\n", ok ? "all maps equal" : "MAPS DIFFER");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+// Copyright (C) <2020> <Jiawei Mo, Junaed Sattar>
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// This file is modified from <https://github.com/JakobEngel/dso>
+
+// runs the discrete epipolar search of ImmaturePoint::traceOn on a synthetic
+// image with the SSE and the scalar pattern energy, checks the per-step
+// energies, the best step and the quality against each other and times both.
+// returns non-zero if a check fails.
+
+#include "FullSystem/TracePatternEnergy.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace dso;
+
+static const int W = 640, H = 480;
+static const int TRIALS = 20000;
+static const int MAX_STEPS = 99;
+static const float HUBER_TH = 9;      // setting_huberTH
+static const int MIN_TEST_RADIUS = 2; // setting_minTraceTestRadius
+
+// pattern 8 of staticPattern, the one traceOn runs with SSE.
+static const int pattern8[8][2] = {{0, -2}, {-1, -1}, {1, -1}, {-2, 0},
+                                   {0, 0},  {2, 0},   {-1, 1}, {0, 2}};
+
+static float uniform(float lo, float hi) {
+  return lo + (hi - lo) * (rand() / (float)RAND_MAX);
+}
+
+struct Trace {
+  float ptx, pty, dx, dy;
+  int numSteps;
+  Vec2f pattern[8];
+  EIGEN_ALIGN16 float patX[8], patY[8], refColor[8];
+};
+
+// smooth texture with noise and a few non-finite pixels, as in dI[0] of a
+// frame (only the color channel is read by the trace).
+static void makeImage(std::vector<Eigen::Vector3f> &dI) {
+  dI.resize(W * H);
+  for (int y = 0; y < H; y++)
+    for (int x = 0; x < W; x++) {
+      float c = 128 + 60 * sinf(0.07f * x + 0.5f * sinf(0.03f * y)) +
+                40 * cosf(0.11f * y - 0.04f * x) + uniform(-5, 5);
+      if (rand() % 500 == 0)
+        c = NAN;
+      dI[x + y * W] = Eigen::Vector3f(c, 0, 0);
+    }
+}
+
+// a rotated and scaled pattern, a reference point and an epipolar line that
+// stays inside the image.
+static void makeTrace(const std::vector<Eigen::Vector3f> &dI, Trace &t) {
+  float angle = uniform(-3.14159f, 3.14159f), scale = uniform(0.8f, 1.2f);
+  Mat22f Rplane;
+  Rplane << scale * cosf(angle), -scale * sinf(angle), scale * sinf(angle),
+      scale * cosf(angle);
+
+  float refU = uniform(5, W - 6), refV = uniform(5, H - 6);
+  float a = uniform(0.8f, 1.2f), b = uniform(-10, 10);
+  for (int idx = 0; idx < 8; idx++) {
+    t.pattern[idx] = Rplane * Vec2f(pattern8[idx][0], pattern8[idx][1]);
+    t.patX[idx] = t.pattern[idx][0];
+    t.patY[idx] = t.pattern[idx][1];
+    float c = getInterpolatedElement31(dI.data(), refU + t.pattern[idx][0],
+                                       refV + t.pattern[idx][1], W);
+    t.refColor[idx] = a * (std::isfinite(c) ? c : 128) + b;
+  }
+
+  float dir = uniform(-3.14159f, 3.14159f);
+  t.dx = cosf(dir);
+  t.dy = sinf(dir);
+  t.numSteps = 10 + rand() % (MAX_STEPS - 10 + 1);
+  float margin = 5 + t.numSteps;
+  t.ptx = uniform(margin, W - 1 - margin);
+  t.pty = uniform(margin, H - 1 - margin);
+}
+
+static void search(const std::vector<Eigen::Vector3f> &dI, const Trace &t,
+                   bool sse, float *errors) {
+  float ptx = t.ptx, pty = t.pty;
+  for (int i = 0; i < t.numSteps; i++) {
+    errors[i] = sse ? tracePatternEnergySSE(dI.data(), W, ptx, pty, t.patX,
+                                            t.patY, t.refColor, HUBER_TH)
+                    : tracePatternEnergy(dI.data(), W, ptx, pty, t.pattern,
+                                         t.refColor, 8, HUBER_TH);
+    ptx += t.dx;
+    pty += t.dy;
+  }
+}
+
+// best step and quality as computed by traceOn.
+static int bestStep(const float *errors, int numSteps, float &quality) {
+  float bestEnergy = 1e10;
+  int bestIdx = -1;
+  for (int i = 0; i < numSteps; i++)
+    if (errors[i] < bestEnergy) {
+      bestEnergy = errors[i];
+      bestIdx = i;
+    }
+  float secondBest = 1e10;
+  for (int i = 0; i < numSteps; i++)
+    if ((i < bestIdx - MIN_TEST_RADIUS || i > bestIdx + MIN_TEST_RADIUS) &&
+        errors[i] < secondBest)
+      secondBest = errors[i];
+  quality = secondBest / bestEnergy;
+  return bestIdx;
+}
+
+static bool close(float a, float b) {
+  return fabsf(a - b) <= 1e-5f * std::max(1.0f, std::max(fabsf(a), fabsf(b)));
+}
+
+int main() {
+  srand(1);
+  std::vector<Eigen::Vector3f> dI;
+  makeImage(dI);
+
+  std::vector<Trace> traces(TRIALS);
+  for (int k = 0; k < TRIALS; k++)
+    makeTrace(dI, traces[k]);
+
+  int numEnergyDiff = 0, numBestDiff = 0, numQualityDiff = 0, numTies = 0;
+  long numSteps = 0;
+  float errorsScalar[MAX_STEPS], errorsSSE[MAX_STEPS];
+  for (int k = 0; k < TRIALS; k++) {
+    const Trace &t = traces[k];
+    search(dI, t, false, errorsScalar);
+    search(dI, t, true, errorsSSE);
+    numSteps += t.numSteps;
+    for (int i = 0; i < t.numSteps; i++)
+      if (!close(errorsScalar[i], errorsSSE[i]))
+        numEnergyDiff++;
+
+    float qualityScalar, qualitySSE;
+    int bestScalar = bestStep(errorsScalar, t.numSteps, qualityScalar);
+    int bestSSE = bestStep(errorsSSE, t.numSteps, qualitySSE);
+    if (bestScalar != bestSSE) {
+      // only a tie of the two steps within rounding may pick another step.
+      if (close(errorsScalar[bestScalar], errorsScalar[bestSSE]))
+        numTies++;
+      else
+        numBestDiff++;
+    } else if (!close(qualityScalar, qualitySSE)) {
+      numQualityDiff++;
+    }
+  }
+
+  double tScalar = 0, tSSE = 0;
+  volatile float sink = 0;
+  for (int sse = 0; sse < 2; sse++) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int k = 0; k < TRIALS; k++) {
+      search(dI, traces[k], sse, errorsSSE);
+      sink += errorsSSE[0];
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    (sse ? tSSE : tScalar) +=
+        std::chrono::duration<double, std::nano>(t1 - t0).count();
+  }
+
+  bool ok = numEnergyDiff == 0 && numBestDiff == 0 && numQualityDiff == 0;
+  printf("%d traces, %ld steps: %d energy, %d best step, %d quality "
+         "mismatches, %d ties\n",
+         TRIALS, numSteps, numEnergyDiff, numBestDiff, numQualityDiff,
+         numTies);
+  printf("scalar %.1f ns/step, SSE %.1f ns/step\n", tScalar / numSteps,
+         tSSE / numSteps);
+  printf("%s\n", ok ? "SSE matches scalar" : "SSE DIFFERS");
+  return ok ? 0 : 1;
+}
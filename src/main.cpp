@@ -284,12 +284,30 @@ int main(int argc, char **argv) {
   nhPriv.param("nomt", nomt, false);
   nhPriv.param("preset", preset, 0);
   nhPriv.param("mode", mode, 1);
+  nhPriv.param("coarse_tracking_mode", setting_coarseTrackingMode, 0);
+  nhPriv.param("spatial_point_order", setting_spatialPointOrder, false);
+  nhPriv.param("distance_transform", setting_distanceTransform, true);
+  nhPriv.param("tile_activation", setting_tileActivation, true);
+  nhPriv.param("trace_budget", setting_traceBudget, 0);
+  nhPriv.param("num_threads", setting_numThreads, 0); // 0: one per core
+  nhPriv.param<std::string>("cpu_tracking", setting_cpuTracking, "");
+  // cpus of the thread that builds the coarse tracking reference of a new
+  // keyframe, there is no separate mapping thread.
+  nhPriv.param<std::string>("cpu_mapping", setting_cpuMapping, "");
+  nhPriv.param<std::string>("cpu_workers", setting_cpuWorkers, "");
+  nhPriv.param("solver_mode", setting_solverMode, 0);
   nhPriv.param<std::string>("vignette", vignette, "");
   nhPriv.param<std::string>("gamma", gamma, "");
 
   double td_cam_imu;
   nhPriv.param("timeshift_cam_imu", td_cam_imu, 0.0);
   nhPriv.param("weight_imu_dso", setting_weight_imu_dso, 1.0);
+  nhPriv.param("imu_trust_th", setting_imuTrustTH, 0.0f); // px, 0: off
+
+  // at most NUM_THREADS (64), cores beyond that are not used.
+  if (setting_numThreads <= 0)
+    setting_numThreads = boost::thread::hardware_concurrency();
+  setting_numThreads = std::max(1, std::min(setting_numThreads, NUM_THREADS));
 
   // read from a bag file
   std::string bag_path;
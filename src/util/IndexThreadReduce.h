@@ -23,39 +23,73 @@
 
 #pragma once
 #include "boost/thread.hpp"
+#include "ThreadAffinity.h"
 #include "settings.h"
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 namespace dso {
 
+/*
+ * parallel for with reduction over [first, end) in chunks of stepSize.
+ *
+ * the caller takes part as tid 0, the other setting_numThreads-1 tids are
+ * worker threads (pinned by setting_cpuWorkers). chunks are split evenly into
+ * one range per participating thread; each thread takes chunks from the front
+ * of its own range and, once that is empty, steals the back half of another
+ * thread's range (a range is one atomic (begin, end) word, so neither side
+ * takes a lock). every thread reduces into its own cache-line padded partial,
+ * the caller sums them at the end. idle workers spin for a while before they
+ * park on a condition variable, and ranges of a single chunk run on the caller
+ * without waking anyone.
+ *
+ * as before, callPerIndex gets a zeroed Running per chunk, and every tid that
+ * got no chunk is called once with an empty range (0, 0) - the accumulators
+ * rely on that to reset their per-thread state. those empty calls run on the
+ * caller.
+ */
 template <typename Running> class IndexThreadReduce {
 
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
   inline IndexThreadReduce() {
-    nextIndex = 0;
-    maxIndex = 0;
-    stepSize = 1;
-    callPerIndex = boost::bind(&IndexThreadReduce::callPerIndexDefault, this,
-                               _1, _2, _3, _4);
-
+    callPerIndex = 0;
+    first = end = stepSize = 0;
+    numBusy = 0;
     running = true;
-    for (int i = 0; i < NUM_THREADS; i++) {
-      isDone[i] = false;
-      gotOne[i] = true;
-      workerThreads[i] = boost::thread(&IndexThreadReduce::workerLoop, this, i);
+    numInline = numParallel = 0;
+    inlineTime = parallelTime = 0;
+
+    // fixed here: the accumulators size their per-thread work by the same
+    // setting.
+    numThreads = setting_numThreads;
+    assert(numThreads >= 1 && numThreads <= NUM_THREADS);
+
+    // spinning only pays off if every thread has a core of its own.
+    spinCount =
+        (int)boost::thread::hardware_concurrency() >= numThreads ? 4000 : 0;
+
+    for (int i = 0; i < numThreads; i++) {
+      perThread[i].range = 0;
+      perThread[i].wake = 0;
+      perThread[i].gotOne = false;
     }
+    for (int i = 1; i < numThreads; i++)
+      workerThreads[i] = boost::thread(&IndexThreadReduce::workerLoop, this, i);
   }
   inline ~IndexThreadReduce() {
-    running = false;
-
-    exMutex.lock();
-    todo_signal.notify_all();
-    exMutex.unlock();
+    {
+      boost::unique_lock<boost::mutex> lock(parkMutex);
+      running = false;
+      todo_signal.notify_all();
+    }
 
-    for (int i = 0; i < NUM_THREADS; i++)
+    for (int i = 1; i < numThreads; i++)
       workerThreads[i].join();
 
     printf("destroyed ThreadReduce\n");
@@ -64,131 +98,175 @@ public:
   inline void
   reduce(boost::function<void(int, int, Running *, int)> callPerIndex,
          int first, int end, int stepSize = 0) {
+    boost::unique_lock<boost::mutex> reduceLock(reduceMutex);
+    auto reduce_start = std::chrono::steady_clock::now();
 
     memset(&stats, 0, sizeof(Running));
 
-    //		if(!multiThreading)
-    //		{
-    //			callPerIndex(first, end, &stats, 0);
-    //			return;
-    //		}
-
     if (stepSize == 0)
-      stepSize = ((end - first) + NUM_THREADS - 1) / NUM_THREADS;
-
-    // printf("reduce called\n");
-
-    boost::unique_lock<boost::mutex> lock(exMutex);
+      stepSize = ((end - first) + numThreads - 1) / numThreads;
+    int numChunks = end > first ? (end - first + stepSize - 1) / stepSize : 0;
+    int numParts = std::min(numChunks, numThreads);
 
     // save
-    this->callPerIndex = callPerIndex;
-    nextIndex = first;
-    maxIndex = end;
+    this->callPerIndex = &callPerIndex;
+    this->first = first;
+    this->end = end;
     this->stepSize = stepSize;
 
-    // go worker threads!
-    for (int i = 0; i < NUM_THREADS; i++) {
-      isDone[i] = false;
-      gotOne[i] = false;
+    for (int i = 0; i < numThreads; i++) {
+      memset(&perThread[i].stats, 0, sizeof(Running));
+      perThread[i].gotOne = false;
+      perThread[i].range =
+          i < numParts ? packRange((numChunks * i) / numParts,
+                                   (numChunks * (i + 1)) / numParts)
+                       : 0;
     }
 
-    // let them start!
-    todo_signal.notify_all();
+    // go worker threads! only as many as there are ranges.
+    if (numParts > 1) {
+      numBusy = numParts - 1;
+      boost::unique_lock<boost::mutex> lock(parkMutex);
+      for (int i = 1; i < numParts; i++)
+        perThread[i].wake = 1;
+      todo_signal.notify_all();
+    }
 
-    // printf("reduce waiting for threads to finish\n");
-    // wait for all worker threads to signal they are done.
-    while (true) {
-      // wait for at least one to finish
-      done_signal.wait(lock);
-      // printf("thread finished!\n");
-
-      // check if actually all are finished.
-      bool allDone = true;
-      for (int i = 0; i < NUM_THREADS; i++)
-        allDone = allDone && isDone[i];
-
-      // all are finished! exit.
-      if (allDone)
-        break;
+    runChunks(0);
+
+    // wait for the workers; they are at most one chunk away.
+    for (int spin = 0; numBusy != 0; spin++)
+      if (spin >= spinCount)
+        boost::this_thread::yield();
+
+    for (int i = 0; i < numThreads; i++) {
+      if (!perThread[i].gotOne) {
+        Running s;
+        memset(&s, 0, sizeof(Running));
+        callPerIndex(0, 0, &s, i);
+        perThread[i].stats += s;
+      }
+      stats += perThread[i].stats;
     }
 
-    nextIndex = 0;
-    maxIndex = 0;
-    this->callPerIndex = boost::bind(&IndexThreadReduce::callPerIndexDefault,
-                                     this, _1, _2, _3, _4);
+    this->callPerIndex = 0;
+
+    float us = std::chrono::duration<float, std::micro>(
+                   std::chrono::steady_clock::now() - reduce_start)
+                   .count();
+    if (numParts > 1) {
+      numParallel++;
+      parallelTime += us;
+    } else {
+      numInline++;
+      inlineTime += us;
+    }
+  }
 
-    // printf("reduce done (all threads finished)\n");
+  // mean wall time per reduce() call, for calls that ran on the caller alone
+  // (at most one chunk) and calls that woke workers.
+  void printStats() const {
+    printf("ThreadReduce: %d inline calls %.1f us, %d parallel calls %.1f us\n",
+           numInline, inlineTime / std::max(1, numInline), numParallel,
+           parallelTime / std::max(1, numParallel));
   }
 
   Running stats;
 
 private:
+  // per-thread state, padded so two threads never write to one cache line.
+  struct PerThread {
+    Running stats;
+    std::atomic<uint64_t> range; // chunks [begin, end) as begin << 32 | end.
+    std::atomic<int> wake;
+    bool gotOne;
+    char padding[64];
+  };
+
   boost::thread workerThreads[NUM_THREADS];
-  bool isDone[NUM_THREADS];
-  bool gotOne[NUM_THREADS];
+  PerThread perThread[NUM_THREADS];
 
-  boost::mutex exMutex;
+  boost::mutex reduceMutex;
+  boost::mutex parkMutex;
   boost::condition_variable todo_signal;
-  boost::condition_variable done_signal;
+  std::atomic<int> numBusy;
+  std::atomic<bool> running;
 
-  int nextIndex;
-  int maxIndex;
-  int stepSize;
+  boost::function<void(int, int, Running *, int)> *callPerIndex;
+  int first, end, stepSize;
 
-  bool running;
+  int numThreads;
+  int spinCount;
+  int numInline, numParallel;
+  float inlineTime, parallelTime;
 
-  boost::function<void(int, int, Running *, int)> callPerIndex;
+  static inline uint64_t packRange(uint32_t begin, uint32_t end) {
+    return ((uint64_t)begin << 32) | end;
+  }
 
-  void callPerIndexDefault(int i, int j, Running *k, int tid) {
-    printf("ERROR: should never be called....\n");
-    assert(false);
+  // next chunk from the front of the own range, -1 if empty.
+  inline int popChunk(int tid) {
+    uint64_t r = perThread[tid].range;
+    while (true) {
+      uint32_t b = r >> 32, e = (uint32_t)r;
+      if (b >= e)
+        return -1;
+      if (perThread[tid].range.compare_exchange_weak(r, packRange(b + 1, e)))
+        return b;
+    }
   }
 
-  void workerLoop(int idx) {
-    boost::unique_lock<boost::mutex> lock(exMutex);
-
-    while (running) {
-      // try to get something to do.
-      int todo = 0;
-      bool gotSomething = false;
-      if (nextIndex < maxIndex) {
-        // got something!
-        todo = nextIndex;
-        nextIndex += stepSize;
-        gotSomething = true;
+  // steals the back half of another range, keeps the rest of it as the own
+  // range and returns its first chunk; -1 if everything is taken.
+  inline int stealChunk(int tid) {
+    for (int k = 1; k < numThreads; k++) {
+      PerThread &victim = perThread[(tid + k) % numThreads];
+      uint64_t r = victim.range;
+      while (true) {
+        uint32_t b = r >> 32, e = (uint32_t)r;
+        if (b >= e)
+          break;
+        uint32_t n = (e - b + 1) / 2;
+        if (victim.range.compare_exchange_weak(r, packRange(b, e - n))) {
+          perThread[tid].range = packRange(e - n + 1, e);
+          return e - n;
+        }
       }
+    }
+    return -1;
+  }
 
-      // if got something: do it (unlock in the meantime)
-      if (gotSomething) {
-        lock.unlock();
+  inline void runChunks(int tid) {
+    int c;
+    while ((c = popChunk(tid)) >= 0 || (c = stealChunk(tid)) >= 0) {
+      int idx = first + c * stepSize;
+      Running s;
+      memset(&s, 0, sizeof(Running));
+      (*callPerIndex)(idx, std::min(idx + stepSize, end), &s, tid);
+      perThread[tid].stats += s;
+      perThread[tid].gotOne = true;
+    }
+  }
 
-        assert(callPerIndex != 0);
+  void workerLoop(int idx) {
+    pinCurrentThread(setting_cpuWorkers, idx - 1);
 
-        Running s;
-        memset(&s, 0, sizeof(Running));
-        callPerIndex(todo, std::min(todo + stepSize, maxIndex), &s, idx);
-        gotOne[idx] = true;
-        lock.lock();
-        stats += s;
+    while (true) {
+      // spin, then park.
+      for (int spin = 0; spin < spinCount && !perThread[idx].wake && running;
+           spin++)
+        ;
+      if (!perThread[idx].wake) {
+        boost::unique_lock<boost::mutex> lock(parkMutex);
+        while (!perThread[idx].wake && running)
+          todo_signal.wait(lock);
       }
+      if (!running)
+        return;
 
-      // otherwise wait on signal, releasing lock in the meantime.
-      else {
-        if (!gotOne[idx]) {
-          lock.unlock();
-          assert(callPerIndex != 0);
-          Running s;
-          memset(&s, 0, sizeof(Running));
-          callPerIndex(0, 0, &s, idx);
-          gotOne[idx] = true;
-          lock.lock();
-          stats += s;
-        }
-        isDone[idx] = true;
-        // printf("worker %d waiting..\n", idx);
-        done_signal.notify_all();
-        todo_signal.wait(lock);
-      }
+      runChunks(idx);
+      perThread[idx].wake = 0;
+      numBusy--;
     }
   }
 };
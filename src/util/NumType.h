@@ -34,7 +34,7 @@ namespace dso {
 #define SSEE(val, idx) (*(((float *)&val) + idx))
 
 #define MAX_RES_PER_POINT 8
-#define NUM_THREADS 6
+#define NUM_THREADS 64 // upper bound for setting_numThreads, sizes per-thread arrays
 
 #define todouble(x) (x).cast<double>()
 
@@ -0,0 +1,124 @@
+/**
+ * This file is part of DSO.
+ *
+ * Copyright 2016 Technical University of Munich and Intel.
+ * Developed by Jakob Engel <engelj at in dot tum dot de>,
+ * for more information see <http://vision.in.tum.de/dso>.
+ * If you use this code, please cite the respective publications as
+ * listed on the above website.
+ *
+ * DSO is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DSO is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DSO. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include "boost/thread.hpp"
+#include <Eigen/Core>
+#include <assert.h>
+#include <stdio.h>
+#include <vector>
+
+namespace dso {
+
+// slab allocator for one type of small object that is created and deleted in
+// large numbers (points, residuals). slabs are only freed with the pool, freed
+// objects go to a free list. slabs come from eigen's aligned_malloc and slots
+// are a multiple of 32 bytes apart, so every slot is aligned as eigen needs.
+// a type uses its pool through DSO_POOLED_OPERATOR_NEW(T) instead of
+// EIGEN_MAKE_ALIGNED_OPERATOR_NEW, so plain new / delete stay valid.
+template <typename T> class ObjectPool {
+public:
+  static ObjectPool &instance() {
+    static ObjectPool pool;
+    return pool;
+  }
+
+  inline void *allocate() {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (freeList == 0)
+      addSlab();
+    Slot *s = freeList;
+    freeList = s->next;
+    numUsed++;
+    if (numUsed > peakUsed)
+      peakUsed = numUsed;
+    return s;
+  }
+
+  inline void deallocate(void *p) {
+    if (p == 0)
+      return;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    Slot *s = (Slot *)p;
+    s->next = freeList;
+    freeList = s;
+    numUsed--;
+  }
+
+  // makes sure the next n allocations do not need a new slab.
+  void reserve(int n) {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while ((int)(slabs.size() * SlabSize) - numUsed < n)
+      addSlab();
+  }
+
+  // occupancy: live objects, highest number of live objects so far, and
+  // allocated slots.
+  int used() const { return numUsed; }
+  int peak() const { return peakUsed; }
+  int capacity() const { return slabs.size() * SlabSize; }
+
+  void printStats(const char *name) const {
+    printf("Pool %s: %d used, %d peak, %d slots (%.1f MB)\n", name, numUsed,
+           peakUsed, capacity(), Stride * capacity() / (1024.0 * 1024.0));
+  }
+
+private:
+  struct Slot {
+    Slot *next;
+  };
+  static const int SlabSize = 1024;
+  static const size_t Stride =
+      ((sizeof(T) > sizeof(Slot) ? sizeof(T) : sizeof(Slot)) + 31) & ~31;
+
+  ObjectPool() : freeList(0), numUsed(0), peakUsed(0) {}
+  ~ObjectPool() {
+    for (char *s : slabs)
+      Eigen::internal::aligned_free(s);
+  }
+
+  void addSlab() {
+    char *slab = (char *)Eigen::internal::aligned_malloc(Stride * SlabSize);
+    slabs.push_back(slab);
+    for (int i = SlabSize - 1; i >= 0; i--) {
+      Slot *s = (Slot *)(slab + i * Stride);
+      s->next = freeList;
+      freeList = s;
+    }
+  }
+
+  boost::mutex mutex;
+  std::vector<char *> slabs;
+  Slot *freeList;
+  int numUsed;
+  int peakUsed;
+};
+
+#define DSO_POOLED_OPERATOR_NEW(T)                                             \
+  void *operator new(std::size_t size) {                                       \
+    assert(size == sizeof(T));                                                 \
+    return ObjectPool<T>::instance().allocate();                               \
+  }                                                                            \
+  void operator delete(void *p) { ObjectPool<T>::instance().deallocate(p); }
+
+} // namespace dso
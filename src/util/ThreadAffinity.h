@@ -0,0 +1,96 @@
+/**
+ * This file is part of DSO.
+ *
+ * Copyright 2016 Technical University of Munich and Intel.
+ * Developed by Jakob Engel <engelj at in dot tum dot de>,
+ * for more information see <http://vision.in.tum.de/dso>.
+ * If you use this code, please cite the respective publications as
+ * listed on the above website.
+ *
+ * DSO is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DSO is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DSO. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace dso {
+
+#ifdef __linux__
+// parses a cpu list as taskset -c takes it ("0-3,8,10-11") into set. returns
+// false if the list is malformed or names a cpu of CPU_SETSIZE or above.
+inline bool parseCpuList(const std::string &list, cpu_set_t &set) {
+  CPU_ZERO(&set);
+  const char *p = list.c_str();
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if (end == p)
+      return false;
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1)
+        return false;
+      p = end;
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE)
+      return false;
+    for (long cpu = first; cpu <= last; cpu++)
+      CPU_SET(cpu, &set);
+    if (*p == ',')
+      p++;
+    else if (*p)
+      return false;
+  }
+  return true;
+}
+#endif
+
+// pins the calling thread to the cpus in cpuList (see parseCpuList); with
+// nth >= 0 only to the nth cpu of the list, wrapping around. an empty list
+// leaves the thread to the scheduler. no-op where affinity is not supported.
+inline void pinCurrentThread(const std::string &cpuList, int nth = -1) {
+  if (cpuList.empty())
+    return;
+
+#ifdef __linux__
+  cpu_set_t set;
+  if (!parseCpuList(cpuList, set) || CPU_COUNT(&set) == 0) {
+    printf("invalid cpu list \"%s\", thread not pinned!\n", cpuList.c_str());
+    return;
+  }
+
+  if (nth >= 0) {
+    nth %= CPU_COUNT(&set);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set) && nth-- == 0) {
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        break;
+      }
+  }
+
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0)
+    printf("could not pin thread to cpus %s!\n", cpuList.c_str());
+#endif
+}
+
+} // namespace dso
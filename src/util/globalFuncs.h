@@ -327,6 +327,22 @@ getInterpolatedElement42(const Eigen::Vector4f *const mat, const float x,
          (1 - dx - dy + dxdy) * *(const Eigen::Vector2f *)(bp);
 }
 
+// z-order (Morton) code of a pixel: interleaves the bits of x and y, so that
+// sorting by it keeps neighbouring pixels close in memory.
+EIGEN_ALWAYS_INLINE uint32_t mortonCode(uint32_t x, uint32_t y) {
+  x &= 0xffff;
+  y &= 0xffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  y = (y | (y << 8)) & 0x00ff00ff;
+  y = (y | (y << 4)) & 0x0f0f0f0f;
+  y = (y | (y << 2)) & 0x33333333;
+  y = (y | (y << 1)) & 0x55555555;
+  return x | (y << 1);
+}
+
 inline Vec3f makeRainbowf3F(float id) {
   id *= freeDebugParam3;
   if (id < 0)
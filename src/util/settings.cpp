@@ -55,6 +55,7 @@ float setting_initialCalibHessian = 5e9;
 /* some modes for solving the resulting linear system (e.g. orthogonalize wrt.
  * unobservable dimensions) */
 double setting_solverModeDelta = 0.00001;
+int setting_solverMode = SOLVER_KKT_DENSE; // how the imu KKT system is solved.
 bool setting_forceAceptStep = true;
 
 /* some thresholds on when to activate / marginalize points */
@@ -117,6 +118,22 @@ float setting_frameEnergyTHN = 0.7f;
 float setting_frameEnergyTHFacMedian = 1.5;
 float setting_overallEnergyTHWeight = 1;
 float setting_coarseCutoffTH = 20;
+int setting_coarseTrackingMode =
+    0; // 0 = forward-additive, 1 = inverse-compositional (reference-side
+       // Jacobians and a constant Hessian per level: cheaper LM iterations,
+       // but robust weights are ignored in H, so convergence is slightly
+       // slower on frames with many outliers).
+bool setting_spatialPointOrder =
+    false; // order coarse tracking point clouds and each host's points along a
+           // Morton curve, and prefetch the predicted target pixels.
+bool setting_distanceTransform =
+    true; // build the coarse distance map with a two-pass distance transform
+          // (same values as the ring BFS, but linear in the image size).
+bool setting_tileActivation =
+    true; // decide point activation per image tile in parallel, instead of
+          // growing the distance map after every activated point. points in
+          // different tiles are decided in a fixed tile order, so the result
+          // is deterministic but not identical to the sequential order.
 
 // parameters controlling pixel selection
 float setting_minGradHistCut = 0.5;
@@ -141,6 +158,8 @@ float setting_trace_slackInterval =
     1.5; // if pixel-interval is smaller than this, leave it be.
 float setting_trace_minImprovementFactor =
     2; // if pixel-interval is smaller than this, leave it be.
+int setting_traceBudget =
+    0; // max # immature points traced per frame, by tracePriority(). 0 = all.
 
 // for benchmarking different undistortion settings
 float benchmarkSetting_fxfyfac = 0;
@@ -160,6 +179,14 @@ float freeDebugParam5 = 1;
 bool disableReconfigure = false;
 bool debugSaveImages = false;
 bool multiThreading = true;
+int setting_numThreads = 6; // threads reducing in parallel, incl. the caller.
+                            // 1..NUM_THREADS, set before the system is made.
+std::string setting_cpuTracking = ""; // cpus of the tracking thread as in
+                                      // taskset -c ("0-3,8"), "" = not pinned.
+std::string setting_cpuMapping = "";  // same for the thread building the
+                                      // coarse tracking reference.
+std::string setting_cpuWorkers = "";  // same for the reduce workers, one cpu
+                                      // each.
 bool disableAllDisplay = false;
 bool setting_onlyLogKFPoses = false;
 bool setting_logStuff = true;
@@ -189,6 +216,16 @@ double setting_g_norm = 9.80665;    // gravity norm
 float setting_maxImuInterval = 0.5; // max time interval (seconds) for spline
 double setting_scale_trap_thres = 1e-4; // variance to trap scale
 
+float setting_imuTrustTH =
+    0; // expected pixel error of the imu prediction below which tracking only
+       // tries the imu and constant motion predictions. 0 = always try all.
+float setting_imuFallbackFac =
+    2; // with a trusted imu, the remaining initializations are only tried if
+       // the residual exceeds this factor * reTrackThreshold * last residual.
+float setting_coarseConvergeRadius =
+    4; // initial error (in pixels of that level) a pyramid level still
+       // converges from. picks the coarsest level for trusted imu predictions.
+
 Mat33 setting_rot_imu_cam;
 double setting_weight_imu_dso; // factor of spline imu vs dso
 Mat66 setting_weight_imu;      // imu weight (cov^{-1})
@@ -320,6 +357,8 @@ int staticPattern[10][40][2] = {
      {-200, -200}, {-200, -200}},
 };
 
+constexpr int ResidualPattern8::offsets[8][2];
+
 int staticPatternNum[10] = {1, 5, 5, 9, 9, 13, 25, 21, 8, 25};
 
 int staticPatternPadding[10] = {1, 1, 1, 1, 2, 2, 2, 3, 2, 4};
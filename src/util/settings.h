@@ -52,6 +52,11 @@ extern float setting_initialCalibHessian;
 
 extern double setting_solverModeDelta;
 
+#define SOLVER_KKT_DENSE 0  // dense LDLT of the whole imu KKT system.
+#define SOLVER_KKT_SPARSE 1 // sparse LDLT, see SparseKKTSolver.
+#define SOLVER_KKT_SCHUR 2  // cholesky of H, constraints by schur complement.
+extern int setting_solverMode;
+
 extern float setting_minIdepthH_act;
 extern float setting_minIdepthH_marg;
 
@@ -107,6 +112,10 @@ extern float setting_frameEnergyTHN;
 extern float setting_frameEnergyTHFacMedian;
 extern float setting_overallEnergyTHWeight;
 extern float setting_coarseCutoffTH;
+extern int setting_coarseTrackingMode;
+extern bool setting_spatialPointOrder;
+extern bool setting_distanceTransform;
+extern bool setting_tileActivation;
 
 extern float setting_minGradHistCut;
 extern float setting_minGradHistAdd;
@@ -119,6 +128,7 @@ extern float setting_trace_GNThreshold;
 extern float setting_trace_extraSlackOnTH;
 extern float setting_trace_slackInterval;
 extern float setting_trace_minImprovementFactor;
+extern int setting_traceBudget;
 
 extern bool setting_render_displayCoarseTrackingFull;
 extern bool setting_render_renderWindowFrames;
@@ -143,6 +153,10 @@ extern int sparsityFactor;
 extern bool goStepByStep;
 extern bool plotStereoImages;
 extern bool multiThreading;
+extern int setting_numThreads;
+extern std::string setting_cpuTracking;
+extern std::string setting_cpuMapping;
+extern std::string setting_cpuWorkers;
 
 extern float freeDebugParam1;
 extern float freeDebugParam2;
@@ -158,6 +172,10 @@ extern float setting_maxImuInterval;
 extern double setting_g_norm;
 extern double setting_scale_trap_thres;
 
+extern float setting_imuTrustTH;
+extern float setting_imuFallbackFac;
+extern float setting_coarseConvergeRadius;
+
 extern Mat33 setting_rot_imu_cam;
 extern double setting_weight_imu_dso;
 extern Mat66 setting_weight_imu;
@@ -178,4 +196,14 @@ extern int staticPatternPadding[10];
 #define patternP staticPattern[8]
 #define patternPadding 2
 
+// the pattern as a type, for kernels templated on it that unroll over its
+// pixels at compile time. ResidualPattern8 = staticPattern[8].
+struct ResidualPattern8 {
+  static const int num = 8;
+  static const int padding = 2;
+  static constexpr int offsets[8][2] = {{0, -2}, {-1, -1}, {1, -1}, {-2, 0},
+                                        {0, 0},  {2, 0},   {-1, 1}, {0, 2}};
+};
+typedef ResidualPattern8 ActivePattern;
+
 } // namespace dso